@@ -1,5 +1,6 @@
 // Compile: (Windows) cl /std:c++17 sync.cpp /link bcrypt.lib
 //          (GCC)     g++ -std=c++17 sync.cpp -lbcrypt -o sync.exe
+//          (POSIX)   g++ -std=c++17 -O2 sync.cpp -o sync
 
 #include <iostream>
 #include <fstream>
@@ -8,21 +9,44 @@
 #include <vector>
 #include <map>
 #include <chrono>
-#include <future>
 #include <mutex>
 #include <iomanip>
-#include <sstream>
 #include <unordered_set>
 #include <unordered_map>
+#include <set>
+#include <sstream>
 #include <algorithm>
 #include <cctype>
 #include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <memory>
 
 #ifdef _WIN32
 #include <windows.h>
 #include <bcrypt.h>
 #include <ntstatus.h>
 #pragma comment(lib, "Bcrypt")
+#else
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <csetjmp>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <sys/sendfile.h>
+#include <sys/sysmacros.h>
+#include <linux/fiemap.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define SYNC_HAVE_IO_URING 1
 #endif
 
 namespace fs = std::filesystem;
@@ -30,6 +54,7 @@ namespace fs = std::filesystem;
 // new includes for concurrency & priority control
 #include <thread>
 #include <condition_variable>
+#include <deque>
 #include <atomic>
 #include <cerrno>
 
@@ -40,33 +65,201 @@ static bool g_minimum_speed = false;
 // concurrency control for copy tasks
 static int g_max_concurrent_copies = 0; // will be set at runtime based on policy
 
-// small helper semaphore (simple counting semaphore)
-class SimpleSemaphore {
-    std::mutex m;
-    std::condition_variable cv;
-    int count;
+// Pool of copy workers fed by bounded queues, one per (source device,
+// destination device) pair. Every device has its own budget of concurrently
+// running copies (set_limit), and a worker takes the next job from the first
+// queue, round-robin, whose devices both have a free slot. A slow USB disk
+// therefore fills only its own slots while copies between faster devices go
+// on, and threads are added as new devices show up so each one can use its
+// whole budget. submit() blocks while the job's queue is full, so the
+// directory scan never runs more than a few thousand files ahead of the
+// copies, and no thread or future is created per file. Jobs report their own
+// results as they finish; the pool only counts the ones that threw.
+class WorkerPool {
 public:
-    SimpleSemaphore(int initial = 0) : count(initial) {}
-    void acquire() {
+    ~WorkerPool() { stop(); }
+
+    void start(int workers, size_t capacity) {
+        stop();
+        std::lock_guard<std::mutex> lk(m);
+        cap = std::max<size_t>(1, capacity);
+        limit = (size_t)std::max(1, workers);
+        stopping = false;
+        started = true;
+        add_threads();
+    }
+
+    // How many copies may run at once on each device.
+    void set_limit(int n) {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            limit = (size_t)std::max(1, n);
+            add_threads();
+        }
+        not_empty.notify_all();
+    }
+
+    // Jobs waiting in the queues and jobs running, for the concurrency controller.
+    void load(size_t& queued_out, size_t& busy) {
+        std::lock_guard<std::mutex> lk(m);
+        queued_out = queued;
+        busy = running;
+    }
+
+    // Runs the job inline when the pool was never started. Jobs without device
+    // IDs share one queue.
+    void submit(std::function<void()> job, uint64_t src_dev = 0, uint64_t dst_dev = 0) {
+        std::unique_lock<std::mutex> lk(m);
+        if (!started) {
+            lk.unlock();
+            if (!execute(job)) {
+                lk.lock();
+                ++failed;
+            }
+            return;
+        }
+        auto key = std::make_pair(src_dev, dst_dev);
+        auto it = lane_index.find(key);
+        if (it == lane_index.end()) {
+            it = lane_index.emplace(key, lanes.size()).first;
+            lanes.emplace_back();
+            lanes.back().src_dev = src_dev;
+            lanes.back().dst_dev = dst_dev;
+            dev_running.emplace(src_dev, 0);
+            dev_running.emplace(dst_dev, 0);
+            add_threads();
+        }
+        size_t li = it->second;
+        not_full.wait(lk, [&] { return lanes[li].jobs.size() < cap; });
+        lanes[li].jobs.push_back(std::move(job));
+        lanes[li].submitted++;
+        ++queued;
+        lk.unlock();
+        not_empty.notify_one();
+    }
+
+    // Blocks until every submitted job has finished; returns how many of them
+    // failed since the previous call.
+    size_t wait_idle() {
         std::unique_lock<std::mutex> lk(m);
-        cv.wait(lk, [&]{ return count > 0; });
-        --count;
+        idle.wait(lk, [&] { return queued == 0 && running == 0; });
+        size_t f = failed;
+        failed = 0;
+        return f;
     }
-    void release() {
+
+    void stop() {
+        std::vector<std::thread> joining;
         {
             std::lock_guard<std::mutex> lk(m);
-            ++count;
+            stopping = true;
+            joining.swap(threads);
         }
-        cv.notify_one();
+        not_empty.notify_all();
+        for (auto& t : joining) t.join();
+        std::lock_guard<std::mutex> lk(m);
+        started = false;
     }
-    void set_count(int v) {
+
+    // "N copies between D1 and D2, ..." per device pair, or "" with one queue.
+    std::string lane_summary() {
         std::lock_guard<std::mutex> lk(m);
-        count = v > 0 ? v : 0;
-        cv.notify_all();
+        if (lanes.size() < 2) return "";
+        std::string s;
+        for (const Lane& l : lanes) {
+            if (!s.empty()) s += ", ";
+            s += std::to_string(l.submitted) + " job(s) " + device_name(l.src_dev) + " -> " + device_name(l.dst_dev);
+        }
+        return s + " (" + std::to_string(limit) + " per device)";
     }
+
+private:
+    static constexpr size_t MAX_THREADS = 256;
+
+    struct Lane {
+        std::deque<std::function<void()>> jobs;
+        uint64_t src_dev = 0, dst_dev = 0;
+        size_t submitted = 0;
+    };
+
+    static std::string device_name(uint64_t dev) {
+#if defined(__linux__)
+        return std::to_string(major((dev_t)dev)) + ":" + std::to_string(minor((dev_t)dev));
+#else
+        return std::to_string(dev);
+#endif
+    }
+
+    // Enough threads for every known device to fill its budget. Called with m held.
+    void add_threads() {
+        if (stopping) return;
+        size_t devices = std::max<size_t>(1, dev_running.size());
+        size_t want = std::min(MAX_THREADS, limit * devices);
+        while (threads.size() < want) threads.emplace_back([this] { run(); });
+    }
+
+    // Index of the next runnable lane, or SIZE_MAX. Called with m held.
+    size_t pick(bool ignore_limits) {
+        for (size_t k = 0; k < lanes.size(); ++k) {
+            size_t li = (cursor + k) % lanes.size();
+            const Lane& l = lanes[li];
+            if (l.jobs.empty()) continue;
+            if (!ignore_limits && (dev_running[l.src_dev] >= limit || dev_running[l.dst_dev] >= limit)) continue;
+            cursor = li + 1;
+            return li;
+        }
+        return SIZE_MAX;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(m);
+        for (;;) {
+            size_t li = SIZE_MAX;
+            not_empty.wait(lk, [&] { return (li = pick(stopping)) != SIZE_MAX || (stopping && queued == 0); });
+            if (li == SIZE_MAX) return;
+            Lane& l = lanes[li];
+            uint64_t sd = l.src_dev, dd = l.dst_dev;
+            std::function<void()> job = std::move(l.jobs.front());
+            l.jobs.pop_front();
+            --queued;
+            ++running;
+            ++dev_running[sd];
+            if (dd != sd) ++dev_running[dd];
+            lk.unlock();
+            not_full.notify_all();
+            bool ok = execute(job);
+            lk.lock();
+            --running;
+            --dev_running[sd];
+            if (dd != sd) --dev_running[dd];
+            if (!ok) ++failed;
+            if (queued == 0 && running == 0) idle.notify_all();
+            // the freed slots may unblock another queue than the one this
+            // worker picks next
+            if (queued > 0 && lanes.size() > 1) not_empty.notify_one();
+        }
+    }
+
+    static bool execute(const std::function<void()>& job) {
+        try {
+            job();
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    std::mutex m;
+    std::condition_variable not_empty, not_full, idle;
+    std::vector<Lane> lanes;
+    std::map<std::pair<uint64_t, uint64_t>, size_t> lane_index;
+    std::map<uint64_t, size_t> dev_running;
+    std::vector<std::thread> threads;
+    size_t cap = 1, limit = 1, queued = 0, running = 0, failed = 0, cursor = 0;
+    bool stopping = false, started = false;
 };
 
-static std::shared_ptr<SimpleSemaphore> g_copy_sem;
+static WorkerPool g_copy_pool;
 
 // ========== ANSI Color Codes ==========
 
@@ -93,262 +286,4729 @@ const std::string BOLD_MAGENTA = "\033[1;35m";
 const std::string BOLD_CYAN = "\033[1;36m";
 const std::string BOLD_WHITE = "\033[1;37m";
 
-// ========== SHA-256 / fingerprint support ==========
-static bool g_use_sha256 = false;
+// ========== Fingerprint support ==========
+// Fingerprints come in two tiers:
+// - sampled: XXH3-128 over fixed-offset blocks spread across the file (the whole
+//   file when it is small). Cheap, and used for indexing and first comparisons.
+// - full-content: the algorithm picked with --hash (--sha256 is --hash=sha256),
+//   used to confirm a sampled match that did not cover the whole file, within
+//   the --sha256-min/--sha256-max window.
+// HashAlgo::Sampled as the --hash choice means "never escalate".
+enum class HashAlgo { Sampled, Sha256, Xxh3_128, Blake3 };
+
+// content-aware mode: destination index, move detection and hash comparisons
+static bool g_use_content_hash = false;
+static HashAlgo g_hash_algo = HashAlgo::Sampled;
+
+// Default policy:
+// - by default (no --sha256-min and no --sha256-max specified) we treat min/max as NOT set,
+//   which means: if --sha256/--hash is provided, the full hash applies to ALL files.
+// - if user supplies --sha256-min or --sha256-max, the corresponding bound will be enforced.
+
+// value holders
+static uint64_t g_sha256_min_bytes = 0ULL;                 // default 0 = no lower bound
+static uint64_t g_sha256_max_bytes = UINT64_MAX;          // default UINT64_MAX = no upper bound
+
+// flags to indicate whether the user explicitly provided those bounds
+static bool g_sha256_min_set = false;
+static bool g_sha256_max_set = false;
+
+static std::string bytes_to_hex(const uint8_t* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(len * 2, '0');
+    for (size_t i = 0; i < len; ++i) {
+        out[2 * i] = digits[data[i] >> 4];
+        out[2 * i + 1] = digits[data[i] & 15];
+    }
+    return out;
+}
+
+// Fixed-width binary fingerprint (64, 128 or 256 bits) tagged with the algorithm
+// that produced it, so digests from different algorithms never compare equal.
+// Used as the key of every fingerprint map and set; hex is only produced for
+// log output (fingerprint_to_string). An empty digest (len 0) means "no
+// fingerprint": unreadable or empty file.
+struct Digest {
+    HashAlgo algo = HashAlgo::Sampled;
+    uint8_t len = 0;
+    uint8_t bytes[32] = {};
+
+    bool empty() const { return len == 0; }
+    bool operator==(const Digest& o) const {
+        return algo == o.algo && len == o.len && std::memcmp(bytes, o.bytes, len) == 0;
+    }
+    bool operator!=(const Digest& o) const { return !(*this == o); }
+};
+
+namespace std {
+template <> struct hash<Digest> {
+    size_t operator()(const Digest& d) const noexcept {
+        // the digest bytes are already uniformly distributed
+        uint64_t v = 0;
+        std::memcpy(&v, d.bytes, sizeof(v));
+        return (size_t)(v ^ ((uint64_t)d.algo << 56));
+    }
+};
+}
+
+// ========== CPU feature detection ==========
+#if defined(__x86_64__) || defined(_M_X64)
+#define SYNC_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// GCC/Clang need per-function target attributes to emit SHA/AVX2 code from a
+// plain -std=c++17 build; MSVC accepts the intrinsics unconditionally.
+#if defined(SYNC_X86_64) && (defined(__GNUC__) || defined(__clang__))
+#define SYNC_TARGET(features) __attribute__((target(features)))
+#else
+#define SYNC_TARGET(features)
+#endif
+
+struct CpuFeatures {
+    bool sse41 = false;
+    bool avx2 = false;
+    bool sha = false;
+};
+
+static CpuFeatures detect_cpu_features() {
+    CpuFeatures f;
+#ifdef SYNC_X86_64
+    auto cpuid = [](uint32_t leaf, uint32_t sub, uint32_t r[4]) {
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuidex(regs, (int)leaf, (int)sub);
+        for (int i = 0; i < 4; ++i) r[i] = (uint32_t)regs[i];
+#else
+        __cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+    };
+    uint32_t r[4];
+    cpuid(0, 0, r);
+    uint32_t max_leaf = r[0];
+    if (max_leaf < 1) return f;
+    cpuid(1, 0, r);
+    f.sse41 = (r[2] >> 19) & 1;
+    bool osxsave = (r[2] >> 27) & 1;
+    bool avx = (r[2] >> 28) & 1;
+    bool ymm_enabled = false;
+    if (osxsave && avx) {
+        // the OS must save YMM state on context switch before AVX2 is usable
+#if defined(_MSC_VER)
+        ymm_enabled = (_xgetbv(0) & 6) == 6;
+#else
+        uint32_t eax = 0, edx = 0;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        ymm_enabled = (eax & 6) == 6;
+#endif
+    }
+    if (max_leaf >= 7) {
+        cpuid(7, 0, r);
+        f.avx2 = ymm_enabled && ((r[1] >> 5) & 1);
+        f.sha = f.sse41 && ((r[1] >> 29) & 1);
+    }
+#endif
+    return f;
+}
+
+static const CpuFeatures& cpu_features() {
+    static const CpuFeatures f = detect_cpu_features();
+    return f;
+}
+
+// ========== SHA-256 engine ==========
+// Built-in SHA-256 so --sha256 behaves the same on every platform. Three kernels
+// are available and picked at runtime from the CPU features:
+// - SHA-NI: hardware rounds, fastest single-stream path.
+// - AVX2 multi-buffer: eight independent messages per call, used when many files
+//   are hashed together (destination index) on CPUs without SHA-NI.
+// - scalar: portable fallback.
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t SHA256_IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static inline uint32_t load_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void store_be32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static void sha256_blocks_scalar(uint32_t h[8], const uint8_t* data, size_t nblocks) {
+    uint32_t w[64];
+    for (; nblocks > 0; --nblocks, data += 64) {
+        for (int t = 0; t < 16; ++t) w[t] = load_be32(data + 4 * t);
+        for (int t = 16; t < 64; ++t) {
+            uint32_t s0 = rotr32(w[t-15], 7) ^ rotr32(w[t-15], 18) ^ (w[t-15] >> 3);
+            uint32_t s1 = rotr32(w[t-2], 17) ^ rotr32(w[t-2], 19) ^ (w[t-2] >> 10);
+            w[t] = w[t-16] + s0 + w[t-7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int t = 0; t < 64; ++t) {
+            uint32_t S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = hh + S1 + ch + SHA256_K[t] + w[t];
+            uint32_t S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = S0 + maj;
+            hh = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+}
+
+#ifdef SYNC_X86_64
+// One group of four SHA-NI rounds. CUR holds W[4i..4i+3]; PREV/NEXT/PREV2 are the
+// neighbouring schedule registers that sha256msg1/msg2 advance in place.
+#define SHANI_ROUNDS(i, CUR, PREV, NEXT, DO_MSG2, DO_MSG1)                                    \
+    do {                                                                                      \
+        __m128i msg = _mm_add_epi32(CUR, _mm_loadu_si128((const __m128i*)&SHA256_K[4 * (i)])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                                  \
+        if (DO_MSG2) {                                                                        \
+            __m128i tmp = _mm_alignr_epi8(CUR, PREV, 4);                                      \
+            NEXT = _mm_add_epi32(NEXT, tmp);                                                  \
+            NEXT = _mm_sha256msg2_epu32(NEXT, CUR);                                           \
+        }                                                                                     \
+        msg = _mm_shuffle_epi32(msg, 0x0E);                                                   \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);                                  \
+        if (DO_MSG1) PREV = _mm_sha256msg1_epu32(PREV, CUR);                                  \
+    } while (0)
+
+SYNC_TARGET("sha,sse4.1,ssse3")
+static void sha256_blocks_shani(uint32_t h[8], const uint8_t* data, size_t nblocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&h[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&h[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);              // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);        // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);     // CDGH
+
+    for (; nblocks > 0; --nblocks, data += 64) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), MASK);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), MASK);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), MASK);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), MASK);
+
+        SHANI_ROUNDS(0,  m0, m3, m1, false, false);
+        SHANI_ROUNDS(1,  m1, m0, m2, false, true);
+        SHANI_ROUNDS(2,  m2, m1, m3, false, true);
+        SHANI_ROUNDS(3,  m3, m2, m0, true,  true);
+        SHANI_ROUNDS(4,  m0, m3, m1, true,  true);
+        SHANI_ROUNDS(5,  m1, m0, m2, true,  true);
+        SHANI_ROUNDS(6,  m2, m1, m3, true,  true);
+        SHANI_ROUNDS(7,  m3, m2, m0, true,  true);
+        SHANI_ROUNDS(8,  m0, m3, m1, true,  true);
+        SHANI_ROUNDS(9,  m1, m0, m2, true,  true);
+        SHANI_ROUNDS(10, m2, m1, m3, true,  true);
+        SHANI_ROUNDS(11, m3, m2, m0, true,  true);
+        SHANI_ROUNDS(12, m0, m3, m1, true,  true);
+        SHANI_ROUNDS(13, m1, m0, m2, true,  false);
+        SHANI_ROUNDS(14, m2, m1, m3, true,  false);
+        SHANI_ROUNDS(15, m3, m2, m0, false, false);
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);           // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);        // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);     // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        // ABEF
+    _mm_storeu_si128((__m128i*)&h[0], state0);
+    _mm_storeu_si128((__m128i*)&h[4], state1);
+}
+#undef SHANI_ROUNDS
+
+SYNC_TARGET("avx2")
+static inline __m256i rotr32x8(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// Compresses one 64-byte block for each of eight independent messages.
+// st is word-major (st[word][lane]) so every state word is a single YMM load.
+SYNC_TARGET("avx2")
+static void sha256_x8_avx2(uint32_t st[8][8], const uint8_t* const blocks[8]) {
+    const __m256i BSWAP = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                          12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i w[16];
+    for (int half = 0; half < 2; ++half) {
+        __m256i r[8];
+        for (int l = 0; l < 8; ++l) r[l] = _mm256_loadu_si256((const __m256i*)(blocks[l] + 32 * half));
+        // 8x8 transpose of 32-bit words: lane-major rows -> word-major rows
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+        __m256i* out = w + 8 * half;
+        out[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x20), BSWAP);
+        out[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x20), BSWAP);
+        out[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x20), BSWAP);
+        out[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x20), BSWAP);
+        out[4] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u0, u4, 0x31), BSWAP);
+        out[5] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u1, u5, 0x31), BSWAP);
+        out[6] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u2, u6, 0x31), BSWAP);
+        out[7] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(u3, u7, 0x31), BSWAP);
+    }
+
+    __m256i a = _mm256_loadu_si256((const __m256i*)st[0]), b = _mm256_loadu_si256((const __m256i*)st[1]);
+    __m256i c = _mm256_loadu_si256((const __m256i*)st[2]), d = _mm256_loadu_si256((const __m256i*)st[3]);
+    __m256i e = _mm256_loadu_si256((const __m256i*)st[4]), f = _mm256_loadu_si256((const __m256i*)st[5]);
+    __m256i g = _mm256_loadu_si256((const __m256i*)st[6]), h = _mm256_loadu_si256((const __m256i*)st[7]);
+    const __m256i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e, f0 = f, g0 = g, h0 = h;
+
+    for (int t = 0; t < 64; ++t) {
+        __m256i wt;
+        if (t < 16) {
+            wt = w[t];
+        } else {
+            __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(w15, 7), rotr32x8(w15, 18)), _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(w2, 17), rotr32x8(w2, 19)), _mm256_srli_epi32(w2, 10));
+            wt = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            w[t & 15] = wt;
+        }
+        __m256i S1 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(e, 6), rotr32x8(e, 11)), rotr32x8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1),
+                                      _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32((int)SHA256_K[t]), wt)));
+        __m256i S0 = _mm256_xor_si256(_mm256_xor_si256(rotr32x8(a, 2), rotr32x8(a, 13)), rotr32x8(a, 22));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(S0, maj);
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1); d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+
+    _mm256_storeu_si256((__m256i*)st[0], _mm256_add_epi32(a, a0));
+    _mm256_storeu_si256((__m256i*)st[1], _mm256_add_epi32(b, b0));
+    _mm256_storeu_si256((__m256i*)st[2], _mm256_add_epi32(c, c0));
+    _mm256_storeu_si256((__m256i*)st[3], _mm256_add_epi32(d, d0));
+    _mm256_storeu_si256((__m256i*)st[4], _mm256_add_epi32(e, e0));
+    _mm256_storeu_si256((__m256i*)st[5], _mm256_add_epi32(f, f0));
+    _mm256_storeu_si256((__m256i*)st[6], _mm256_add_epi32(g, g0));
+    _mm256_storeu_si256((__m256i*)st[7], _mm256_add_epi32(h, h0));
+}
+#endif
+
+enum class Sha256Engine { Scalar, Avx2MultiBuffer, ShaNi };
+
+static Sha256Engine select_sha256_engine() {
+    const CpuFeatures& f = cpu_features();
+    if (f.sha) return Sha256Engine::ShaNi;
+    if (f.avx2) return Sha256Engine::Avx2MultiBuffer;
+    return Sha256Engine::Scalar;
+}
+
+static const Sha256Engine g_sha256_engine = select_sha256_engine();
+
+static const char* sha256_engine_name(Sha256Engine e) {
+    switch (e) {
+        case Sha256Engine::ShaNi: return "sha-ni";
+        case Sha256Engine::Avx2MultiBuffer: return "avx2-x8";
+        default: return "scalar";
+    }
+}
+
+using Sha256BlocksFn = void (*)(uint32_t h[8], const uint8_t* data, size_t nblocks);
+
+// Single-stream kernel. The AVX2 engine only speeds up batches, so a lone
+// stream on such CPUs uses the scalar rounds.
+static Sha256BlocksFn sha256_single_stream_kernel() {
+#ifdef SYNC_X86_64
+    if (g_sha256_engine == Sha256Engine::ShaNi) return sha256_blocks_shani;
+#endif
+    return sha256_blocks_scalar;
+}
+
+static const Sha256BlocksFn g_sha256_blocks = sha256_single_stream_kernel();
+
+struct Sha256 {
+    uint32_t h[8];
+    uint64_t total = 0;       // bytes absorbed so far
+    uint8_t buf[64];
+    size_t buf_len = 0;
+    Sha256BlocksFn blocks = g_sha256_blocks;
+
+    Sha256() { std::copy(SHA256_IV, SHA256_IV + 8, h); }
+
+    void update(const uint8_t* data, size_t len) {
+        total += len;
+        if (buf_len > 0) {
+            size_t take = std::min(len, 64 - buf_len);
+            std::memcpy(buf + buf_len, data, take);
+            buf_len += take; data += take; len -= take;
+            if (buf_len < 64) return;
+            blocks(h, buf, 1);
+            buf_len = 0;
+        }
+        if (len >= 64) {
+            blocks(h, data, len / 64);
+            data += len & ~(size_t)63;
+            len &= 63;
+        }
+        if (len > 0) { std::memcpy(buf, data, len); buf_len = len; }
+    }
+
+    void finish(uint8_t out[32]) {
+        uint64_t bit_len = total * 8;
+        uint8_t pad[128] = {0x80};
+        size_t pad_len = (buf_len < 56) ? (56 - buf_len) : (120 - buf_len);
+        for (int i = 0; i < 8; ++i) pad[pad_len + i] = (uint8_t)(bit_len >> (56 - 8 * i));
+        uint64_t saved_total = total;
+        update(pad, pad_len + 8);
+        total = saved_total;
+        for (int i = 0; i < 8; ++i) store_be32(out + 4 * i, h[i]);
+    }
+};
+
+static const size_t HASH_READ_CHUNK = 256 * 1024;
+
+// ========== XXH3-128 ==========
+// Streaming XXH3 128-bit hash (xxHash 0.8 output, seed 0, default secret). Not
+// cryptographic, but it runs at memory bandwidth, which makes full-content
+// comparisons affordable on large trees. The stripe accumulator has AVX2, SSE2
+// and scalar versions, picked at runtime.
+
+static const uint8_t XXH3_SECRET[192] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+static const uint32_t XXH_PRIME32_1 = 0x9E3779B1U;
+static const uint32_t XXH_PRIME32_2 = 0x85EBCA77U;
+static const uint32_t XXH_PRIME32_3 = 0xC2B2AE3DU;
+static const uint64_t XXH_PRIME_MX1 = 0x165667919E3779F9ULL;
+static const uint64_t XXH_PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t XXH_STRIPE_LEN = 64;
+static const size_t XXH_SECRET_CONSUME_RATE = 8;
+static const size_t XXH_SECRET_LIMIT = sizeof(XXH3_SECRET) - XXH_STRIPE_LEN;
+static const size_t XXH_STRIPES_PER_BLOCK = XXH_SECRET_LIMIT / XXH_SECRET_CONSUME_RATE;
+static const size_t XXH_INTERNAL_BUFFER = 256;
+static const size_t XXH_MIDSIZE_MAX = 240;
+
+static inline uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t* p) {
+    return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+static inline void store_be64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (uint8_t)(v >> (56 - 8 * i));
+}
+
+static inline uint64_t swap64(uint64_t v) {
+    uint8_t b[8];
+    store_be64(b, v);
+    return read_le64(b);
+}
+
+static inline void mult64to128(uint64_t a, uint64_t b, uint64_t& lo, uint64_t& hi) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    lo = (uint64_t)r;
+    hi = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    lo = _umul128(a, b, &hi);
+#else
+    uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hi_hi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    lo = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+#endif
+}
+
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+    uint64_t lo, hi;
+    mult64to128(a, b, lo, hi);
+    return lo ^ hi;
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33; h *= XXH_PRIME64_2;
+    h ^= h >> 29; h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t* in, const uint8_t* secret) {
+    return mul128_fold64(read_le64(in) ^ read_le64(secret), read_le64(in + 8) ^ read_le64(secret + 8));
+}
+
+struct Xxh128Value { uint64_t lo, hi; };
+
+static inline void xxh128_mix32(Xxh128Value& acc, const uint8_t* in1, const uint8_t* in2, const uint8_t* secret) {
+    acc.lo += xxh3_mix16(in1, secret);
+    acc.lo ^= read_le64(in2) + read_le64(in2 + 8);
+    acc.hi += xxh3_mix16(in2, secret + 16);
+    acc.hi ^= read_le64(in1) + read_le64(in1 + 8);
+}
+
+// One-shot XXH3-128 for inputs of at most XXH_MIDSIZE_MAX bytes.
+static Xxh128Value xxh3_128_short(const uint8_t* in, size_t len) {
+    const uint8_t* s = XXH3_SECRET;
+    Xxh128Value r;
+    if (len == 0) {
+        r.lo = xxh64_avalanche(read_le64(s + 64) ^ read_le64(s + 72));
+        r.hi = xxh64_avalanche(read_le64(s + 80) ^ read_le64(s + 88));
+    } else if (len <= 3) {
+        uint8_t c1 = in[0], c2 = in[len >> 1], c3 = in[len - 1];
+        uint32_t combinedl = ((uint32_t)c1 << 16) | ((uint32_t)c2 << 24) | (uint32_t)c3 | ((uint32_t)len << 8);
+        uint32_t swapped = (combinedl >> 24) | ((combinedl >> 8) & 0xFF00) | ((combinedl << 8) & 0xFF0000) | (combinedl << 24);
+        uint32_t combinedh = (swapped << 13) | (swapped >> 19);
+        uint64_t bitflipl = (uint64_t)(read_le32(s) ^ read_le32(s + 4));
+        uint64_t bitfliph = (uint64_t)(read_le32(s + 8) ^ read_le32(s + 12));
+        r.lo = xxh64_avalanche((uint64_t)combinedl ^ bitflipl);
+        r.hi = xxh64_avalanche((uint64_t)combinedh ^ bitfliph);
+    } else if (len <= 8) {
+        uint64_t input64 = (uint64_t)read_le32(in) + ((uint64_t)read_le32(in + len - 4) << 32);
+        uint64_t keyed = input64 ^ (read_le64(s + 16) ^ read_le64(s + 24));
+        uint64_t lo, hi;
+        mult64to128(keyed, XXH_PRIME64_1 + (len << 2), lo, hi);
+        hi += lo << 1;
+        lo ^= hi >> 3;
+        lo ^= lo >> 35;
+        lo *= XXH_PRIME_MX2;
+        lo ^= lo >> 28;
+        r.lo = lo;
+        r.hi = xxh3_avalanche(hi);
+    } else if (len <= 16) {
+        uint64_t bitflipl = read_le64(s + 32) ^ read_le64(s + 40);
+        uint64_t bitfliph = read_le64(s + 48) ^ read_le64(s + 56);
+        uint64_t input_lo = read_le64(in);
+        uint64_t input_hi = read_le64(in + len - 8);
+        uint64_t mlo, mhi;
+        mult64to128(input_lo ^ input_hi ^ bitflipl, XXH_PRIME64_1, mlo, mhi);
+        mlo += (uint64_t)(len - 1) << 54;
+        input_hi ^= bitfliph;
+        mhi += input_hi + (uint64_t)(uint32_t)input_hi * (XXH_PRIME32_2 - 1);
+        mlo ^= swap64(mhi);
+        uint64_t hlo, hhi;
+        mult64to128(mlo, XXH_PRIME64_2, hlo, hhi);
+        hhi += mhi * XXH_PRIME64_2;
+        r.lo = xxh3_avalanche(hlo);
+        r.hi = xxh3_avalanche(hhi);
+    } else {
+        Xxh128Value acc{len * XXH_PRIME64_1, 0};
+        if (len <= 128) {
+            if (len > 32) {
+                if (len > 64) {
+                    if (len > 96) xxh128_mix32(acc, in + 48, in + len - 64, s + 96);
+                    xxh128_mix32(acc, in + 32, in + len - 48, s + 64);
+                }
+                xxh128_mix32(acc, in + 16, in + len - 32, s + 32);
+            }
+            xxh128_mix32(acc, in, in + len - 16, s);
+        } else {
+            const size_t MIDSIZE_STARTOFFSET = 3, MIDSIZE_LASTOFFSET = 17, SECRET_SIZE_MIN = 136;
+            size_t i;
+            for (i = 32; i < 160; i += 32) xxh128_mix32(acc, in + i - 32, in + i - 16, s + i - 32);
+            acc.lo = xxh3_avalanche(acc.lo);
+            acc.hi = xxh3_avalanche(acc.hi);
+            for (i = 160; i <= len; i += 32)
+                xxh128_mix32(acc, in + i - 32, in + i - 16, s + MIDSIZE_STARTOFFSET + i - 160);
+            xxh128_mix32(acc, in + len - 16, in + len - 32, s + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET - 16);
+        }
+        r.lo = xxh3_avalanche(acc.lo + acc.hi);
+        r.hi = (uint64_t)0 - xxh3_avalanche(acc.lo * XXH_PRIME64_1 + acc.hi * XXH_PRIME64_4 + len * XXH_PRIME64_2);
+    }
+    return r;
+}
+
+using Xxh3AccumulateFn = void (*)(uint64_t* acc, const uint8_t* in, const uint8_t* secret, size_t nstripes);
+using Xxh3ScrambleFn = void (*)(uint64_t* acc, const uint8_t* secret);
+
+static void xxh3_accumulate_scalar(uint64_t* acc, const uint8_t* in, const uint8_t* secret, size_t nstripes) {
+    for (size_t n = 0; n < nstripes; ++n, in += XXH_STRIPE_LEN, secret += XXH_SECRET_CONSUME_RATE) {
+        for (size_t i = 0; i < 8; ++i) {
+            uint64_t data_val = read_le64(in + 8 * i);
+            uint64_t data_key = data_val ^ read_le64(secret + 8 * i);
+            acc[i ^ 1] += data_val;
+            acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+        }
+    }
+}
+
+static void xxh3_scramble_scalar(uint64_t* acc, const uint8_t* secret) {
+    for (size_t i = 0; i < 8; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= read_le64(secret + 8 * i);
+        a *= XXH_PRIME32_1;
+        acc[i] = a;
+    }
+}
+
+#ifdef SYNC_X86_64
+static void xxh3_accumulate_sse2(uint64_t* acc, const uint8_t* in, const uint8_t* secret, size_t nstripes) {
+    __m128i a[4];
+    for (int i = 0; i < 4; ++i) a[i] = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+    for (size_t n = 0; n < nstripes; ++n, in += XXH_STRIPE_LEN, secret += XXH_SECRET_CONSUME_RATE) {
+        for (int i = 0; i < 4; ++i) {
+            __m128i data_vec = _mm_loadu_si128((const __m128i*)(in + 16 * i));
+            __m128i data_key = _mm_xor_si128(data_vec, _mm_loadu_si128((const __m128i*)(secret + 16 * i)));
+            __m128i product = _mm_mul_epu32(data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i data_swap = _mm_shuffle_epi32(data_vec, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(product, _mm_add_epi64(a[i], data_swap));
+        }
+    }
+    for (int i = 0; i < 4; ++i) _mm_storeu_si128((__m128i*)(acc + 2 * i), a[i]);
+}
+
+static void xxh3_scramble_sse2(uint64_t* acc, const uint8_t* secret) {
+    const __m128i prime32 = _mm_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 4; ++i) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(acc + 2 * i));
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        __m128i data_key = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(secret + 16 * i)));
+        __m128i data_key_hi = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i prod_lo = _mm_mul_epu32(data_key, prime32);
+        __m128i prod_hi = _mm_mul_epu32(data_key_hi, prime32);
+        _mm_storeu_si128((__m128i*)(acc + 2 * i), _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+    }
+}
+
+SYNC_TARGET("avx2")
+static void xxh3_accumulate_avx2(uint64_t* acc, const uint8_t* in, const uint8_t* secret, size_t nstripes) {
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+    for (size_t n = 0; n < nstripes; ++n, in += XXH_STRIPE_LEN, secret += XXH_SECRET_CONSUME_RATE) {
+        __m256i d0 = _mm256_loadu_si256((const __m256i*)in);
+        __m256i d1 = _mm256_loadu_si256((const __m256i*)(in + 32));
+        __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i*)secret));
+        __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256((const __m256i*)(secret + 32)));
+        __m256i p0 = _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32));
+        __m256i p1 = _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32));
+        a0 = _mm256_add_epi64(p0, _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm256_add_epi64(p1, _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)(acc + 4), a1);
+}
+
+SYNC_TARGET("avx2")
+static void xxh3_scramble_avx2(uint64_t* acc, const uint8_t* secret) {
+    const __m256i prime32 = _mm256_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 2; ++i) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + 4 * i));
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        __m256i data_key = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(secret + 32 * i)));
+        __m256i prod_lo = _mm256_mul_epu32(data_key, prime32);
+        __m256i prod_hi = _mm256_mul_epu32(_mm256_srli_epi64(data_key, 32), prime32);
+        _mm256_storeu_si256((__m256i*)(acc + 4 * i), _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32)));
+    }
+}
+#endif
+
+struct Xxh3Kernels { Xxh3AccumulateFn accumulate; Xxh3ScrambleFn scramble; const char* name; };
+
+static Xxh3Kernels select_xxh3_kernels() {
+#ifdef SYNC_X86_64
+    if (cpu_features().avx2) return { xxh3_accumulate_avx2, xxh3_scramble_avx2, "avx2" };
+    return { xxh3_accumulate_sse2, xxh3_scramble_sse2, "sse2" };
+#else
+    return { xxh3_accumulate_scalar, xxh3_scramble_scalar, "scalar" };
+#endif
+}
+
+static const Xxh3Kernels g_xxh3_kernels = select_xxh3_kernels();
+
+static uint64_t xxh3_merge_accs(const uint64_t* acc, const uint8_t* secret, uint64_t start) {
+    uint64_t r = start;
+    for (int i = 0; i < 4; ++i)
+        r += mul128_fold64(acc[2 * i] ^ read_le64(secret + 16 * i), acc[2 * i + 1] ^ read_le64(secret + 16 * i + 8));
+    return xxh3_avalanche(r);
+}
+
+struct Xxh3_128 {
+    uint64_t acc[8] = { XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+                        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1 };
+    uint8_t buffer[XXH_INTERNAL_BUFFER];
+    size_t buffered = 0;
+    size_t stripes_so_far = 0;   // stripes consumed in the current block
+    uint64_t total = 0;
+    Xxh3Kernels k = g_xxh3_kernels;
+
+    // Feeds whole stripes, scrambling at every block boundary.
+    const uint8_t* consume_stripes(uint64_t* a, size_t& so_far, const uint8_t* in, size_t nstripes) const {
+        const uint8_t* secret = XXH3_SECRET + so_far * XXH_SECRET_CONSUME_RATE;
+        if (nstripes >= XXH_STRIPES_PER_BLOCK - so_far) {
+            size_t this_iter = XXH_STRIPES_PER_BLOCK - so_far;
+            do {
+                k.accumulate(a, in, secret, this_iter);
+                k.scramble(a, XXH3_SECRET + XXH_SECRET_LIMIT);
+                in += this_iter * XXH_STRIPE_LEN;
+                nstripes -= this_iter;
+                this_iter = XXH_STRIPES_PER_BLOCK;
+                secret = XXH3_SECRET;
+            } while (nstripes >= XXH_STRIPES_PER_BLOCK);
+            so_far = 0;
+        }
+        if (nstripes > 0) {
+            k.accumulate(a, in, secret, nstripes);
+            in += nstripes * XXH_STRIPE_LEN;
+            so_far += nstripes;
+        }
+        return in;
+    }
+
+    void update(const uint8_t* in, size_t len) {
+        total += len;
+        if (len <= XXH_INTERNAL_BUFFER - buffered) {
+            std::memcpy(buffer + buffered, in, len);
+            buffered += len;
+            return;
+        }
+        const uint8_t* end = in + len;
+        if (buffered) {
+            size_t load = XXH_INTERNAL_BUFFER - buffered;
+            std::memcpy(buffer + buffered, in, load);
+            in += load;
+            consume_stripes(acc, stripes_so_far, buffer, XXH_INTERNAL_BUFFER / XXH_STRIPE_LEN);
+            buffered = 0;
+        }
+        if ((size_t)(end - in) > XXH_INTERNAL_BUFFER) {
+            // always keep the last stripe buffered: digest() needs it
+            size_t nstripes = (size_t)(end - 1 - in) / XXH_STRIPE_LEN;
+            in = consume_stripes(acc, stripes_so_far, in, nstripes);
+            std::memcpy(buffer + XXH_INTERNAL_BUFFER - XXH_STRIPE_LEN, in - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+        }
+        std::memcpy(buffer, in, (size_t)(end - in));
+        buffered = (size_t)(end - in);
+    }
+
+    void finish(uint8_t out[16]) {
+        Xxh128Value r;
+        if (total > XXH_MIDSIZE_MAX) {
+            uint64_t a[8];
+            std::memcpy(a, acc, sizeof(a));
+            uint8_t last_stripe[XXH_STRIPE_LEN];
+            const uint8_t* last;
+            if (buffered >= XXH_STRIPE_LEN) {
+                size_t so_far = stripes_so_far;
+                consume_stripes(a, so_far, buffer, (buffered - 1) / XXH_STRIPE_LEN);
+                last = buffer + buffered - XXH_STRIPE_LEN;
+            } else {
+                size_t catchup = XXH_STRIPE_LEN - buffered;
+                std::memcpy(last_stripe, buffer + XXH_INTERNAL_BUFFER - catchup, catchup);
+                std::memcpy(last_stripe + catchup, buffer, buffered);
+                last = last_stripe;
+            }
+            const size_t LASTACC_START = 7, MERGEACCS_START = 11;
+            k.accumulate(a, last, XXH3_SECRET + XXH_SECRET_LIMIT - LASTACC_START, 1);
+            r.lo = xxh3_merge_accs(a, XXH3_SECRET + MERGEACCS_START, total * XXH_PRIME64_1);
+            r.hi = xxh3_merge_accs(a, XXH3_SECRET + sizeof(XXH3_SECRET) - sizeof(a) - MERGEACCS_START,
+                                   ~(total * XXH_PRIME64_2));
+        } else {
+            r = xxh3_128_short(buffer, (size_t)total);
+        }
+        // canonical form: high half first, big-endian
+        store_be64(out, r.hi);
+        store_be64(out + 8, r.lo);
+    }
+};
+
+// ========== BLAKE3 ==========
+// Portable BLAKE3 (unkeyed, 256-bit output). The chunk tree makes it parallel
+// friendly: whenever eight whole chunks are buffered and more input follows,
+// the AVX2 kernel compresses all eight chunks side by side.
+
+static const uint8_t BLAKE3_MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+static const uint32_t BLAKE3_CHUNK_START = 1, BLAKE3_CHUNK_END = 2, BLAKE3_PARENT = 4, BLAKE3_ROOT = 8;
+static const size_t BLAKE3_CHUNK_LEN = 1024;
+static const size_t BLAKE3_BLOCK_LEN = 64;
+
+static inline void blake3_g(uint32_t* v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    v[a] = v[a] + v[b] + x; v[d] = rotr32(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y; v[d] = rotr32(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];     v[b] = rotr32(v[b] ^ v[c], 7);
+}
+
+static void blake3_compress(const uint32_t cv[8], const uint8_t block[64], uint32_t block_len,
+                            uint64_t counter, uint32_t flags, uint32_t out[16]) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) m[i] = read_le32(block + 4 * i);
+    uint32_t v[16] = { cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                       SHA256_IV[0], SHA256_IV[1], SHA256_IV[2], SHA256_IV[3],
+                       (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags };
+    for (int r = 0; r < 7; ++r) {
+        const uint8_t* s = BLAKE3_MSG_SCHEDULE[r];
+        blake3_g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        blake3_g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        blake3_g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        blake3_g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        blake3_g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        blake3_g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        blake3_g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        blake3_g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+#ifdef SYNC_X86_64
+SYNC_TARGET("avx2")
+static inline __m256i blake3_rot16x8(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+SYNC_TARGET("avx2")
+static inline __m256i blake3_rot8x8(__m256i x) {
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+SYNC_TARGET("avx2")
+static inline void blake3_g8(__m256i* v, int a, int b, int c, int d, __m256i x, __m256i y) {
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+    v[d] = blake3_rot16x8(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotr32x8(_mm256_xor_si256(v[b], v[c]), 12);
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+    v[d] = blake3_rot8x8(_mm256_xor_si256(v[d], v[a]));
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+    v[b] = rotr32x8(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+// Chaining values of eight consecutive whole chunks starting at chunk `counter`.
+SYNC_TARGET("avx2")
+static void blake3_hash8_chunks_avx2(const uint8_t* input, uint64_t counter, uint32_t out_cvs[8][8]) {
+    __m256i cv[8];
+    for (int i = 0; i < 8; ++i) cv[i] = _mm256_set1_epi32((int)SHA256_IV[i]);
+    uint32_t ctr_lo[8], ctr_hi[8];
+    for (int l = 0; l < 8; ++l) { ctr_lo[l] = (uint32_t)(counter + l); ctr_hi[l] = (uint32_t)((counter + l) >> 32); }
+    const __m256i counter_lo = _mm256_loadu_si256((const __m256i*)ctr_lo);
+    const __m256i counter_hi = _mm256_loadu_si256((const __m256i*)ctr_hi);
+
+    for (size_t blk = 0; blk < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; ++blk) {
+        __m256i m[16];
+        for (int half = 0; half < 2; ++half) {
+            __m256i r[8];
+            for (int l = 0; l < 8; ++l)
+                r[l] = _mm256_loadu_si256((const __m256i*)(input + l * BLAKE3_CHUNK_LEN + blk * BLAKE3_BLOCK_LEN + 32 * half));
+            __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+            __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+            __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+            __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+            __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+            __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+            __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+            __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+            __m256i* out = m + 8 * half;
+            out[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+            out[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+            out[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+            out[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+            out[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+            out[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+            out[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+            out[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        }
+        uint32_t flags = (blk == 0 ? BLAKE3_CHUNK_START : 0) |
+                         (blk == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? BLAKE3_CHUNK_END : 0);
+        __m256i v[16] = { cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                          _mm256_set1_epi32((int)SHA256_IV[0]), _mm256_set1_epi32((int)SHA256_IV[1]),
+                          _mm256_set1_epi32((int)SHA256_IV[2]), _mm256_set1_epi32((int)SHA256_IV[3]),
+                          counter_lo, counter_hi,
+                          _mm256_set1_epi32((int)BLAKE3_BLOCK_LEN), _mm256_set1_epi32((int)flags) };
+        for (int rnd = 0; rnd < 7; ++rnd) {
+            const uint8_t* s = BLAKE3_MSG_SCHEDULE[rnd];
+            blake3_g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+            blake3_g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+            blake3_g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+            blake3_g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+            blake3_g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+            blake3_g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+            blake3_g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+            blake3_g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+        }
+        for (int i = 0; i < 8; ++i) cv[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+
+    uint32_t words[8][8];
+    for (int i = 0; i < 8; ++i) _mm256_storeu_si256((__m256i*)words[i], cv[i]);
+    for (int l = 0; l < 8; ++l)
+        for (int i = 0; i < 8; ++i) out_cvs[l][i] = words[i][l];
+}
+#endif
+
+struct Blake3 {
+    // chunk currently being filled
+    uint32_t chunk_cv[8];
+    uint64_t chunk_counter = 0;
+    uint8_t block[BLAKE3_BLOCK_LEN];
+    size_t block_len = 0;
+    size_t blocks_compressed = 0;
+    // chaining values of completed subtrees, one per set bit of chunk_counter
+    uint32_t cv_stack[54][8];
+    size_t cv_stack_len = 0;
+    bool wide = cpu_features().avx2;
+
+    Blake3() { std::copy(SHA256_IV, SHA256_IV + 8, chunk_cv); }
+
+    size_t chunk_len() const { return blocks_compressed * BLAKE3_BLOCK_LEN + block_len; }
+    uint32_t chunk_start_flag() const { return blocks_compressed == 0 ? BLAKE3_CHUNK_START : 0; }
+
+    static void parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t out[8]) {
+        uint8_t blk[64];
+        for (int i = 0; i < 8; ++i) {
+            for (int b = 0; b < 4; ++b) {
+                blk[4 * i + b] = (uint8_t)(left[i] >> (8 * b));
+                blk[32 + 4 * i + b] = (uint8_t)(right[i] >> (8 * b));
+            }
+        }
+        uint32_t full[16];
+        blake3_compress(SHA256_IV, blk, 64, 0, BLAKE3_PARENT, full);
+        std::copy(full, full + 8, out);
+    }
+
+    // Merges completed subtrees: one merge per trailing zero bit of total_chunks.
+    void push_chunk_cv(const uint32_t cv_in[8], uint64_t total_chunks) {
+        uint32_t cv[8];
+        std::copy(cv_in, cv_in + 8, cv);
+        while ((total_chunks & 1) == 0) {
+            parent_cv(cv_stack[--cv_stack_len], cv, cv);
+            total_chunks >>= 1;
+        }
+        std::copy(cv, cv + 8, cv_stack[cv_stack_len++]);
+    }
+
+    void reset_chunk(uint64_t counter) {
+        std::copy(SHA256_IV, SHA256_IV + 8, chunk_cv);
+        chunk_counter = counter;
+        block_len = 0;
+        blocks_compressed = 0;
+    }
+
+    void chunk_update(const uint8_t* in, size_t len) {
+        while (len > 0) {
+            if (block_len == BLAKE3_BLOCK_LEN) {
+                uint32_t full[16];
+                blake3_compress(chunk_cv, block, BLAKE3_BLOCK_LEN, chunk_counter, chunk_start_flag(), full);
+                std::copy(full, full + 8, chunk_cv);
+                ++blocks_compressed;
+                block_len = 0;
+            }
+            size_t take = std::min(BLAKE3_BLOCK_LEN - block_len, len);
+            std::memcpy(block + block_len, in, take);
+            block_len += take; in += take; len -= take;
+        }
+    }
+
+    void update(const uint8_t* in, size_t len) {
+        while (len > 0) {
+            if (chunk_len() == BLAKE3_CHUNK_LEN) {
+                // more input follows, so this chunk is not the root
+                uint32_t full[16];
+                blake3_compress(chunk_cv, block, (uint32_t)block_len, chunk_counter,
+                                chunk_start_flag() | BLAKE3_CHUNK_END, full);
+                push_chunk_cv(full, chunk_counter + 1);
+                reset_chunk(chunk_counter + 1);
+            }
+#ifdef SYNC_X86_64
+            if (wide && chunk_len() == 0 && len > 8 * BLAKE3_CHUNK_LEN) {
+                uint32_t cvs[8][8];
+                blake3_hash8_chunks_avx2(in, chunk_counter, cvs);
+                for (int l = 0; l < 8; ++l) push_chunk_cv(cvs[l], chunk_counter + l + 1);
+                reset_chunk(chunk_counter + 8);
+                in += 8 * BLAKE3_CHUNK_LEN;
+                len -= 8 * BLAKE3_CHUNK_LEN;
+                continue;
+            }
+#endif
+            size_t take = std::min(BLAKE3_CHUNK_LEN - chunk_len(), len);
+            chunk_update(in, take);
+            in += take; len -= take;
+        }
+    }
+
+    void finish(uint8_t out[32]) {
+        // the output node starts as the current chunk and climbs the cv stack
+        uint32_t node_cv[8];
+        uint8_t node_block[64];
+        uint32_t node_len = (uint32_t)block_len;
+        uint64_t node_counter = chunk_counter;
+        uint32_t node_flags = chunk_start_flag() | BLAKE3_CHUNK_END;
+        std::copy(chunk_cv, chunk_cv + 8, node_cv);
+        std::memset(node_block, 0, sizeof(node_block));
+        std::memcpy(node_block, block, block_len);
+        for (size_t i = cv_stack_len; i > 0; --i) {
+            uint32_t full[16];
+            blake3_compress(node_cv, node_block, node_len, node_counter, node_flags, full);
+            for (int w = 0; w < 8; ++w) {
+                for (int b = 0; b < 4; ++b) {
+                    node_block[4 * w + b] = (uint8_t)(cv_stack[i - 1][w] >> (8 * b));
+                    node_block[32 + 4 * w + b] = (uint8_t)(full[w] >> (8 * b));
+                }
+            }
+            std::copy(SHA256_IV, SHA256_IV + 8, node_cv);
+            node_len = 64;
+            node_counter = 0;
+            node_flags = BLAKE3_PARENT;
+        }
+        uint32_t root[16];
+        blake3_compress(node_cv, node_block, node_len, 0, node_flags | BLAKE3_ROOT, root);
+        for (int w = 0; w < 8; ++w)
+            for (int b = 0; b < 4; ++b) out[4 * w + b] = (uint8_t)(root[w] >> (8 * b));
+    }
+};
+
+// ========== Hasher interface ==========
+static const char* hash_algo_name(HashAlgo a) {
+    switch (a) {
+        case HashAlgo::Sha256: return "sha256";
+        case HashAlgo::Xxh3_128: return "xxh3-128";
+        case HashAlgo::Blake3: return "blake3";
+        default: return "sampled";
+    }
+}
+
+static bool parse_hash_algo(std::string s, HashAlgo& out) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return (char)std::tolower(c); });
+    if (s == "sampled" || s == "fnv" || s == "fnv64") out = HashAlgo::Sampled; // fnv: pre-sampling name
+    else if (s == "sha256" || s == "sha-256") out = HashAlgo::Sha256;
+    else if (s == "xxh3" || s == "xxh3-128" || s == "xxh128") out = HashAlgo::Xxh3_128;
+    else if (s == "blake3") out = HashAlgo::Blake3;
+    else return false;
+    return true;
+}
+
+// Streaming hasher for the full-content algorithms. The sampled tier has none:
+// see compute_file_sampled.
+class Hasher {
+public:
+    virtual ~Hasher() = default;
+    virtual void update(const uint8_t* data, size_t len) = 0;
+    virtual Digest finish() = 0;
+};
+
+template <class Impl, HashAlgo Algo, size_t DigestLen>
+class DigestHasher : public Hasher {
+    Impl impl;
+public:
+    void update(const uint8_t* data, size_t len) override { impl.update(data, len); }
+    Digest finish() override {
+        static_assert(DigestLen <= sizeof(Digest::bytes), "digest too wide");
+        Digest d;
+        d.algo = Algo;
+        d.len = (uint8_t)DigestLen;
+        impl.finish(d.bytes);
+        return d;
+    }
+};
+
+static std::unique_ptr<Hasher> make_hasher(HashAlgo a) {
+    switch (a) {
+        case HashAlgo::Sha256: return std::make_unique<DigestHasher<Sha256, HashAlgo::Sha256, 32>>();
+        case HashAlgo::Xxh3_128: return std::make_unique<DigestHasher<Xxh3_128, HashAlgo::Xxh3_128, 16>>();
+        case HashAlgo::Blake3: return std::make_unique<DigestHasher<Blake3, HashAlgo::Blake3, 32>>();
+        default: return nullptr;
+    }
+}
+
+// Per-thread read buffer for the hashing paths, allocated once per thread
+// instead of once per file. slot selects one of a few independent buffers for
+// callers that keep several files in flight (the SHA-256 multi-buffer lanes).
+static std::vector<uint8_t>& hash_read_buffer(size_t slot = 0) {
+    static thread_local std::vector<uint8_t> bufs[8];
+    std::vector<uint8_t>& b = bufs[slot];
+    if (b.size() != HASH_READ_CHUNK) b.resize(HASH_READ_CHUNK);
+    return b;
+}
+
+// ========== I/O throttling ==========
+// --bwlimit and --iops-limit: one token bucket shared by every copy and hash
+// reader. Bytes are charged where data is read (an in-kernel copy counts
+// once), one operation per call; clones move no data and are free. Each call
+// reserves its share up front and sleeps off any debt, and while a byte limit
+// is on, reads and kernel copies go in pieces of about 50 ms worth of
+// bandwidth, so the rate stays smooth instead of bursting a whole file and
+// then stalling. --minimum-speed implies MINIMUM_SPEED_BWLIMIT unless
+// --bwlimit is given.
+static uint64_t g_bwlimit = 0;      // --bwlimit, bytes per second (0 = off)
+static bool g_bwlimit_set = false;
+static uint64_t g_iops_limit = 0;   // --iops-limit (0 = off)
+static const uint64_t MINIMUM_SPEED_BWLIMIT = 25ULL << 20;
+
+class Throttle {
+public:
+    // Call before any I/O starts; active() is read without locking.
+    void configure(uint64_t bytes_per_sec, uint64_t ops_per_sec) {
+        std::lock_guard<std::mutex> lk(m);
+        rate = (double)bytes_per_sec;
+        iops = (double)ops_per_sec;
+        byte_tokens = op_tokens = 0;
+        last = clock::now();
+        piece = bytes_per_sec ? (size_t)std::min<uint64_t>(std::max<uint64_t>(bytes_per_sec / 20, 16 * 1024), 1 << 20) : SIZE_MAX;
+        on = bytes_per_sec > 0 || ops_per_sec > 0;
+    }
+
+    bool active() const { return on; }
+
+    // How much of `want` one call should move.
+    size_t chunk(size_t want) const { return std::min(want, piece); }
+
+    // Charges one operation of `bytes`, sleeping as long as the bucket is in debt.
+    void acquire(uint64_t bytes) {
+        if (!on) return;
+        double wait = 0;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            clock::time_point now = clock::now();
+            double dt = std::chrono::duration<double>(now - last).count();
+            last = now;
+            if (rate > 0) {
+                byte_tokens = std::min(byte_tokens + dt * rate, rate * BURST_SECONDS) - (double)bytes;
+                if (byte_tokens < 0) wait = -byte_tokens / rate;
+            }
+            if (iops > 0) {
+                op_tokens = std::min(op_tokens + dt * iops, std::max(1.0, iops * BURST_SECONDS)) - 1.0;
+                if (op_tokens < 0) wait = std::max(wait, -op_tokens / iops);
+            }
+        }
+        if (wait > 0) std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+    static constexpr double BURST_SECONDS = 0.05;
+    std::mutex m;
+    double rate = 0, iops = 0, byte_tokens = 0, op_tokens = 0;
+    clock::time_point last;
+    size_t piece = SIZE_MAX;
+    bool on = false;
+};
+
+static Throttle g_throttle;
+
+// ========== File readers ==========
+// Input side of the hashing paths. Large sequential reads go through a
+// read-only mapping advised MADV_SEQUENTIAL, with MADV_WILLNEED issued one
+// window ahead of the hasher, so data reaches the hash straight from the page
+// cache with no iostream or user-buffer copy. Small files, random (sampled)
+// reads and files that can't be mapped use pread into a per-thread buffer;
+// Windows always takes that path through ReadFile at explicit offsets.
+// A mapped file truncated under us raises SIGBUS; the mapped loop is guarded
+// so that becomes a read error instead of killing the process.
+enum class ReadMode { Auto, Pread, Mmap };
+static const uint64_t MMAP_MIN_SIZE = 4ULL * 1024 * 1024;
+static const uint64_t MMAP_READAHEAD = 8ULL * 1024 * 1024;
+
+#ifndef _WIN32
+static thread_local sigjmp_buf* t_sigbus_jmp = nullptr;
+
+static void sigbus_handler(int sig) {
+    if (t_sigbus_jmp) siglongjmp(*t_sigbus_jmp, 1);
+    std::signal(sig, SIG_DFL);
+    std::raise(sig);
+}
+
+static void install_sigbus_guard() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = sigbus_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_NODEFER; // the jump leaves the handler, so don't keep SIGBUS blocked
+        sigaction(SIGBUS, &sa, nullptr);
+    });
+}
+
+static uint64_t page_size() {
+    static const uint64_t ps = (uint64_t)sysconf(_SC_PAGESIZE);
+    return ps;
+}
+
+// A run of file data; the gaps between extents are holes that read as zeros.
+struct Extent {
+    uint64_t off, len;
+};
+
+// Appends the data extents of [off, end) found with SEEK_DATA/SEEK_HOLE. When
+// the filesystem can't tell, the rest of the range counts as data. lseek with
+// these whences returns the answer without depending on the current file
+// position, so concurrent callers sharing fd get correct results.
+static void data_extents(int fd, uint64_t off, uint64_t end, std::vector<Extent>& out) {
+    uint64_t pos = off;
+    while (pos < end) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t d = ::lseek(fd, (off_t)pos, SEEK_DATA);
+        if (d < 0) {
+            if (errno == ENXIO) return; // only a hole up to end of file
+            break;
+        }
+        if ((uint64_t)d >= end) return;
+        off_t h = ::lseek(fd, d, SEEK_HOLE);
+        uint64_t stop = h < 0 ? end : std::min<uint64_t>((uint64_t)h, end);
+        out.push_back({ (uint64_t)d, stop - (uint64_t)d });
+        pos = stop;
+#else
+        break;
+#endif
+    }
+    if (pos < end) out.push_back({ pos, end - pos });
+}
+
+// True when st allocates fewer blocks than its size needs, i.e. has holes
+// (or is compressed; data_extents then simply reports all data).
+static bool stat_is_sparse(const struct stat& st) {
+    return (uint64_t)st.st_blocks * 512 + 65536 <= (uint64_t)st.st_size;
+}
+
+static const uint8_t* zero_block() {
+    static const std::vector<uint8_t> z(HASH_READ_CHUNK, 0);
+    return z.data();
+}
+#endif
+
+// --no-cache-pollution: a big sync shouldn't evict the page cache of whatever
+// else runs on the host. Sources are opened O_NOATIME (no atime writes; only
+// allowed for the file owner, so EPERM falls back to a normal open). Read
+// data is dropped with POSIX_FADV_DONTNEED behind every CACHE_DROP_WINDOW of a
+// stream and when a file is closed. Written data is pushed to disk one window
+// behind the writer (sync_file_range), then dropped the same way, so the
+// writer never waits on the window it just wrote. Pages that were cached
+// before the sync are dropped as well. O_DIRECT was not used: it needs aligned
+// buffers and offsets, and it bypasses copy_file_range and reflinks.
+// POSIX only.
+static bool g_no_cache_pollution = false; // --no-cache-pollution
+static const uint64_t CACHE_DROP_WINDOW = 8ULL << 20;
+
+#ifndef _WIN32
+static int open_source_at(int dirfd, const char* path, int flags) {
+#ifdef O_NOATIME
+    if (g_no_cache_pollution) {
+        int fd = ::openat(dirfd, path, flags | O_NOATIME);
+        if (fd >= 0 || errno != EPERM) return fd;
+    }
+#endif
+    return ::openat(dirfd, path, flags);
+}
+
+static int open_source(const fs::path& p, int flags = O_RDONLY | O_CLOEXEC) {
+    return open_source_at(AT_FDCWD, p.c_str(), flags);
+}
+
+// Drops cached pages of a range that was only read (len 0: to end of file).
+static void drop_read_cache(int fd, uint64_t off, uint64_t len) {
+#ifdef POSIX_FADV_DONTNEED
+    if (g_no_cache_pollution) ::posix_fadvise(fd, (off_t)off, (off_t)len, POSIX_FADV_DONTNEED);
+#else
+    (void)fd; (void)off; (void)len;
+#endif
+}
+
+// Write-behind for one output stream: each window handed to written() starts
+// its writeback; the window before it is waited for and dropped, which keeps
+// at most two windows of dirty or cached output. finish() settles the rest.
+class CacheDropper {
+public:
+    CacheDropper(int in_fd, int out_fd) : in(in_fd), out(out_fd) {}
+    ~CacheDropper() { finish(); }
+
+    void written(uint64_t off, uint64_t len) {
+        if (!g_no_cache_pollution || len == 0) return;
+        drop_read_cache(in, off, len);
+#ifdef SYNC_FILE_RANGE_WRITE
+        ::sync_file_range(out, (off_t)off, (off_t)len, SYNC_FILE_RANGE_WRITE);
+#endif
+        settle();
+        prev_off = off;
+        prev_len = len;
+    }
+
+    void finish() {
+        if (!g_no_cache_pollution || prev_len == 0) return;
+#ifndef SYNC_FILE_RANGE_WRITE
+        ::fdatasync(out);
+#endif
+        settle();
+        prev_len = 0;
+    }
+
+private:
+    void settle() {
+        if (prev_len == 0) return;
+#ifdef SYNC_FILE_RANGE_WRITE
+        ::sync_file_range(out, (off_t)prev_off, (off_t)prev_len,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+        ::posix_fadvise(out, (off_t)prev_off, (off_t)prev_len, POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    int in, out;
+    uint64_t prev_off = 0, prev_len = 0;
+};
+
+// For outputs not written front to back (delta, chunk reuse): flushes the
+// finished file and drops its pages.
+static void drop_written_cache(int fd) {
+    if (!g_no_cache_pollution || fd < 0) return;
+    ::fdatasync(fd);
+    drop_read_cache(fd, 0, 0);
+}
+
+// Splits extents into pieces of at most CACHE_DROP_WINDOW when
+// --no-cache-pollution is on, so a CacheDropper sees every window.
+static void split_for_cache(std::vector<Extent>& ext) {
+    if (!g_no_cache_pollution) return;
+    std::vector<Extent> out;
+    for (const Extent& e : ext)
+        for (uint64_t o = 0; o < e.len; o += CACHE_DROP_WINDOW)
+            out.push_back({ e.off + o, std::min(CACHE_DROP_WINDOW, e.len - o) });
+    ext.swap(out);
+}
+#endif
+
+class FileReader {
+public:
+    FileReader() = default;
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+    ~FileReader() { close(); }
+
+    // sequential: the caller reads front to back (mapping and readahead pay
+    // off); otherwise reads are scattered and go through pread. buf_slot picks
+    // the hash_read_buffer used by read_range on the pread path.
+    bool open(const fs::path& p, ReadMode mode = ReadMode::Auto, bool sequential = true, size_t buf_slot = 0) {
+        close();
+        slot = buf_slot;
+#ifdef _WIN32
+        (void)mode;
+        h = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                        OPEN_EXISTING, sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (h == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(h, &sz)) { close(); return false; }
+        len = (uint64_t)sz.QuadPart;
+        return true;
+#else
+        fd = open_source(p);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { close(); return false; }
+        len = (uint64_t)st.st_size;
+        sparse = stat_is_sparse(st);
+        // sparse files go through pread, which skips their holes
+        bool want_map = mode == ReadMode::Mmap ||
+                        (mode == ReadMode::Auto && sequential && len >= MMAP_MIN_SIZE && !sparse && !g_no_cache_pollution);
+        if (want_map && mode != ReadMode::Pread && len > 0 && len <= (uint64_t)SIZE_MAX) {
+            void* m = ::mmap(nullptr, (size_t)len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m != MAP_FAILED) {
+                map = static_cast<const uint8_t*>(m);
+                ::madvise(m, (size_t)len, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                install_sigbus_guard();
+            }
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        if (!map) ::posix_fadvise(fd, 0, 0, sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#endif
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (h != INVALID_HANDLE_VALUE) CloseHandle(h);
+        h = INVALID_HANDLE_VALUE;
+#else
+        if (map) ::munmap(const_cast<uint8_t*>(map), (size_t)len);
+        map = nullptr;
+        if (fd >= 0) {
+            drop_read_cache(fd, 0, 0);
+            ::close(fd);
+        }
+        fd = -1;
+        sparse = false;
+#endif
+        len = 0;
+    }
+
+    uint64_t size() const { return len; }
+    bool mapped() const { return map != nullptr; }
+
+    // Reads up to n bytes at offset off into dst, retrying short reads.
+    // Returns the byte count (less than n only at end of file) or -1.
+    long long pread_into(uint8_t* dst, size_t n, uint64_t off) {
+        size_t done = 0;
+        while (done < n) {
+            size_t step = g_throttle.chunk(n - done);
+            g_throttle.acquire(step);
+#ifdef _WIN32
+            OVERLAPPED ov = {};
+            uint64_t at = off + done;
+            ov.Offset = (DWORD)at;
+            ov.OffsetHigh = (DWORD)(at >> 32);
+            DWORD want = (DWORD)std::min<size_t>(step, 1u << 30), got = 0;
+            if (!ReadFile(h, dst + done, want, &got, &ov)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) break;
+                return -1;
+            }
+            if (got == 0) break;
+            done += got;
+#else
+            ssize_t r = ::pread(fd, dst + done, step, (off_t)(off + done));
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (r == 0) break;
+            done += (size_t)r;
+#endif
+        }
+        return (long long)done;
+    }
+
+    // Passes [off, off + n) to fn(const uint8_t*, size_t) in pieces of at most
+    // HASH_READ_CHUNK bytes. Returns false if the range can't be read in full.
+    template <class F>
+    bool read_range(uint64_t off, uint64_t n, F&& fn) {
+        if (off > len || n > len - off) return false;
+#ifndef _WIN32
+        if (map) {
+            sigjmp_buf env;
+            sigjmp_buf* prev = t_sigbus_jmp;
+            if (sigsetjmp(env, 0)) { t_sigbus_jmp = prev; return false; }
+            t_sigbus_jmp = &env;
+            const uint64_t end = off + n;
+            uint64_t ahead = off & ~(page_size() - 1); // WILLNEED issued up to here
+            for (uint64_t pos = off; pos < end; ) {
+                // keep readahead one to two windows ahead of the hasher; where
+                // supported, the window about to be hashed also gets its page
+                // tables filled in one call instead of one fault per page
+                while (ahead < end && ahead < pos + 2 * MMAP_READAHEAD) {
+                    ::madvise(const_cast<uint8_t*>(map + ahead), (size_t)std::min(MMAP_READAHEAD, end - ahead), MADV_WILLNEED);
+#ifdef MADV_POPULATE_READ
+                    if (ahead > off) {
+                        uint64_t prev = ahead - MMAP_READAHEAD;
+                        ::madvise(const_cast<uint8_t*>(map + prev), (size_t)std::min(MMAP_READAHEAD, end - prev), MADV_POPULATE_READ);
+                    }
+#endif
+                    ahead += MMAP_READAHEAD;
+                }
+                size_t piece = (size_t)std::min<uint64_t>(g_throttle.chunk(HASH_READ_CHUNK), end - pos);
+                g_throttle.acquire(piece);
+                fn(map + pos, piece);
+                pos += piece;
+            }
+            t_sigbus_jmp = prev;
+            return true;
+        }
+#endif
+        std::vector<uint8_t>& buf = hash_read_buffer(slot);
+        auto read_data = [&](uint64_t at, uint64_t left) {
+#ifndef _WIN32
+            uint64_t dropped = at;
+#endif
+            while (left > 0) {
+                size_t want = (size_t)std::min<uint64_t>(left, buf.size());
+                if (pread_into(buf.data(), want, at) != (long long)want) return false;
+                fn(buf.data(), want);
+                at += want;
+                left -= want;
+#ifndef _WIN32
+                if (at - dropped >= CACHE_DROP_WINDOW || left == 0) {
+                    drop_read_cache(fd, dropped, at - dropped);
+                    dropped = at;
+                }
+#endif
+            }
+            return true;
+        };
+#ifndef _WIN32
+        if (sparse) {
+            // holes hash as zeros without being read
+            auto zeros = [&](uint64_t left) {
+                while (left > 0) {
+                    size_t piece = (size_t)std::min<uint64_t>(left, HASH_READ_CHUNK);
+                    fn(zero_block(), piece);
+                    left -= piece;
+                }
+            };
+            std::vector<Extent> ext;
+            data_extents(fd, off, off + n, ext);
+            uint64_t pos = off;
+            for (const Extent& e : ext) {
+                zeros(e.off - pos);
+                if (!read_data(e.off, e.len)) return false;
+                pos = e.off + e.len;
+            }
+            zeros(off + n - pos);
+            return true;
+        }
+#endif
+        return read_data(off, n);
+    }
+
+    bool is_sparse() const { return sparse; }
+
+private:
+#ifdef _WIN32
+    HANDLE h = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+    const uint8_t* map = nullptr;
+    uint64_t len = 0;
+    size_t slot = 0;
+    bool sparse = false;
+};
+
+static Digest compute_file_digest(const fs::path& path, HashAlgo algo, ReadMode mode = ReadMode::Auto) {
+    std::unique_ptr<Hasher> h = make_hasher(algo);
+    if (!h) return Digest();
+    FileReader in;
+    if (!in.open(path, mode)) return Digest();
+    Hasher* hp = h.get();
+    if (!in.read_range(0, in.size(), [hp](const uint8_t* p, size_t n) { hp->update(p, n); })) return Digest();
+    return h->finish();
+}
+
+// Hashes a batch of files. With the AVX2 engine up to eight files are streamed
+// through the multi-buffer kernel side by side: every lane keeps its own read
+// buffer (filled with pread) and scalar-layout state, full blocks go through sha256_x8_avx2 and each
+// lane's tail is finished by the single-stream code. Other engines simply hash
+// the files one after another. Unreadable files yield an empty digest.
+static std::vector<Digest> compute_files_sha256(const std::vector<fs::path>& paths) {
+    std::vector<Digest> out(paths.size());
+#ifdef SYNC_X86_64
+    if (g_sha256_engine == Sha256Engine::Avx2MultiBuffer && paths.size() > 1) {
+        struct Lane {
+            FileReader in;
+            uint64_t off = 0; // next file offset to read
+            bool failed = false;
+            size_t idx = 0;
+            Sha256 ctx;
+            std::vector<uint8_t>* buf = nullptr;
+            size_t pos = 0, len = 0;
+            bool active = false;
+        };
+        static const uint8_t zero_block[64] = {0};
+        Lane lanes[8];
+        for (int l = 0; l < 8; ++l) lanes[l].buf = &hash_read_buffer(l);
+        size_t next = 0;
+
+        auto start_lane = [&](Lane& ln) {
+            while (next < paths.size()) {
+                size_t idx = next++;
+                if (!ln.in.open(paths[idx], ReadMode::Pread)) continue;
+                ln.idx = idx;
+                ln.ctx = Sha256();
+                ln.pos = ln.len = 0;
+                ln.off = 0;
+                ln.failed = false;
+                ln.active = true;
+                return;
+            }
+            ln.active = false;
+        };
+        // Makes sure the lane holds at least one full block, finishing the
+        // lane (and starting the next file) whenever its input runs dry.
+        auto refill = [&](Lane& ln) {
+            while (ln.active && ln.len - ln.pos < 64) {
+                std::vector<uint8_t>& buf = *ln.buf;
+                size_t rest = ln.len - ln.pos;
+                std::memmove(buf.data(), buf.data() + ln.pos, rest);
+                ln.pos = 0; ln.len = rest;
+                if (ln.off < ln.in.size()) {
+                    long long r = ln.in.pread_into(buf.data() + rest, buf.size() - rest, ln.off);
+                    if (r > 0) {
+                        ln.len += (size_t)r;
+                        ln.off += (uint64_t)r;
+                        if (ln.len - ln.pos >= 64) return;
+                        continue;
+                    }
+                    ln.failed = r < 0 || ln.off < ln.in.size(); // error, or truncated under us
+                }
+                if (!ln.failed) {
+                    ln.ctx.update(buf.data(), ln.len);
+                    Digest& d = out[ln.idx];
+                    d.algo = HashAlgo::Sha256;
+                    d.len = 32;
+                    ln.ctx.finish(d.bytes);
+                }
+                ln.in.close();
+                start_lane(ln);
+            }
+        };
+
+        for (auto& ln : lanes) start_lane(ln);
+        uint32_t st[8][8];
+        for (;;) {
+            size_t nblocks = SIZE_MAX;
+            int active = 0;
+            for (auto& ln : lanes) {
+                refill(ln);
+                if (!ln.active) continue;
+                ++active;
+                nblocks = std::min(nblocks, (ln.len - ln.pos) / 64);
+            }
+            if (active == 0) break;
+            if (active == 1) {
+                // a single straggler gains nothing from the wide kernel
+                for (auto& ln : lanes) {
+                    if (!ln.active) continue;
+                    size_t n = (ln.len - ln.pos) & ~(size_t)63;
+                    ln.ctx.update(ln.buf->data() + ln.pos, n);
+                    ln.pos += n;
+                }
+                continue;
+            }
+            for (int l = 0; l < 8; ++l)
+                for (int w = 0; w < 8; ++w) st[w][l] = lanes[l].ctx.h[w];
+            const uint8_t* ptrs[8];
+            for (size_t b = 0; b < nblocks; ++b) {
+                for (int l = 0; l < 8; ++l)
+                    ptrs[l] = lanes[l].active ? lanes[l].buf->data() + lanes[l].pos + 64 * b : zero_block;
+                sha256_x8_avx2(st, ptrs);
+            }
+            for (int l = 0; l < 8; ++l) {
+                Lane& ln = lanes[l];
+                if (!ln.active) continue;
+                for (int w = 0; w < 8; ++w) ln.ctx.h[w] = st[w][l];
+                ln.ctx.total += 64 * nblocks;
+                ln.pos += 64 * nblocks;
+            }
+        }
+        return out;
+    }
+#endif
+    for (size_t i = 0; i < paths.size(); ++i) out[i] = compute_file_digest(paths[i], HashAlgo::Sha256);
+    return out;
+}
+
+#ifdef _WIN32
+// Windows CNG (BCrypt) SHA-256 over a memory buffer; kept for --bench-hash so the
+// built-in kernels can be compared against the platform provider.
+static bool cng_sha256(const uint8_t* data, size_t len, uint8_t out[32]) {
+    BCRYPT_ALG_HANDLE hAlg = NULL;
+    BCRYPT_HASH_HANDLE hHash = NULL;
+    NTSTATUS status = BCryptOpenAlgorithmProvider(&hAlg, BCRYPT_SHA256_ALGORITHM, NULL, 0);
+    if (!BCRYPT_SUCCESS(status) || hAlg == NULL) return false;
+
+    DWORD cbHashObject = 0, cbData = 0;
+    status = BCryptGetProperty(hAlg, BCRYPT_OBJECT_LENGTH, (PUCHAR)&cbHashObject, sizeof(cbHashObject), &cbData, 0);
+    if (!BCRYPT_SUCCESS(status)) { BCryptCloseAlgorithmProvider(hAlg,0); return false; }
+
+    std::vector<uint8_t> hashObject(cbHashObject);
+    status = BCryptCreateHash(hAlg, &hHash, hashObject.data(), (ULONG)hashObject.size(), NULL, 0, 0);
+    if (!BCRYPT_SUCCESS(status) || hHash == NULL) { BCryptCloseAlgorithmProvider(hAlg,0); return false; }
+
+    const size_t CHUNK = 1 << 30;
+    for (size_t off = 0; off < len && BCRYPT_SUCCESS(status); off += CHUNK) {
+        status = BCryptHashData(hHash, (PUCHAR)(data + off), (ULONG)std::min(CHUNK, len - off), 0);
+    }
+    if (BCRYPT_SUCCESS(status)) status = BCryptFinishHash(hHash, out, 32, 0);
+
+    BCryptDestroyHash(hHash);
+    BCryptCloseAlgorithmProvider(hAlg, 0);
+    return BCRYPT_SUCCESS(status);
+}
+#endif
+
+// ========== Hash benchmark ==========
+// --bench-hash: single-threaded throughput of every hash kernel usable on this
+// CPU (GB/s per core). Each accelerated kernel is checked against the portable
+// result, and the portable code against a known answer.
+static void run_hash_benchmark(uint64_t bytes) {
+    if (bytes < 64 * 1024) bytes = 64 * 1024;
+    bytes &= ~(uint64_t)511;
+    std::vector<uint8_t> data((size_t)bytes);
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    for (auto& b : data) { x ^= x << 13; x ^= x >> 7; x ^= x << 17; b = (uint8_t)x; }
+
+    auto hex_of = [](const uint8_t d[32]) { return bytes_to_hex(d, 32); };
+    auto run_single = [&](Sha256BlocksFn fn, uint8_t out[32]) {
+        Sha256 ctx; ctx.blocks = fn;
+        ctx.update(data.data(), data.size());
+        ctx.finish(out);
+    };
+
+    std::cout << "Hash throughput (" << (bytes >> 20) << " MiB buffer, one thread)\n";
+    std::cout << "SHA-256 (selected engine: " << sha256_engine_name(g_sha256_engine) << ")\n";
+
+    {
+        uint8_t kat[32];
+        Sha256 ctx; ctx.blocks = sha256_blocks_scalar;
+        ctx.update(reinterpret_cast<const uint8_t*>("abc"), 3);
+        ctx.finish(kat);
+        bool ok = hex_of(kat) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+        std::cout << "  known-answer test: " << (ok ? "ok" : "FAILED") << "\n";
+    }
+
+    uint8_t ref[32];
+    auto report = [&](const char* name, double secs, const std::string& check) {
+        double gbps = secs > 0 ? (double)bytes / secs / 1e9 : 0.0;
+        std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(8) << gbps << " GB/s" << (check.empty() ? "" : "  [" + check + "]") << "\n";
+    };
+    auto timed = [](const std::function<void()>& fn) {
+        auto t0 = std::chrono::steady_clock::now();
+        fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    };
+
+    double secs = timed([&]{ run_single(sha256_blocks_scalar, ref); });
+    report("scalar", secs, "");
+
+#ifdef SYNC_X86_64
+    if (cpu_features().sha) {
+        uint8_t d[32];
+        secs = timed([&]{ run_single(sha256_blocks_shani, d); });
+        report("sha-ni", secs, std::memcmp(d, ref, 32) == 0 ? "matches scalar" : "MISMATCH");
+    } else {
+        std::cout << "  sha-ni        (not supported by this CPU)\n";
+    }
+    if (cpu_features().avx2) {
+        // eight lanes over eight slices of the buffer: aggregate throughput
+        const size_t slice = data.size() / 8;
+        uint32_t st[8][8];
+        for (int l = 0; l < 8; ++l) for (int w = 0; w < 8; ++w) st[w][l] = SHA256_IV[w];
+        secs = timed([&]{
+            const uint8_t* ptrs[8];
+            for (size_t off = 0; off + 64 <= slice; off += 64) {
+                for (int l = 0; l < 8; ++l) ptrs[l] = data.data() + l * slice + off;
+                sha256_x8_avx2(st, ptrs);
+            }
+        });
+        bool ok = true;
+        for (int l = 0; l < 8 && ok; ++l) {
+            uint32_t h[8];
+            std::copy(SHA256_IV, SHA256_IV + 8, h);
+            sha256_blocks_scalar(h, data.data() + l * slice, slice / 64);
+            for (int w = 0; w < 8; ++w) ok = ok && h[w] == st[w][l];
+        }
+        report("avx2-x8", secs, ok ? "matches scalar" : "MISMATCH");
+    } else {
+        std::cout << "  avx2-x8       (not supported by this CPU)\n";
+    }
+#endif
+
+#ifdef _WIN32
+    {
+        uint8_t d[32];
+        bool ok = false;
+        secs = timed([&]{ ok = cng_sha256(data.data(), data.size(), d); });
+        if (ok) report("cng", secs, std::memcmp(d, ref, 32) == 0 ? "matches scalar" : "MISMATCH");
+        else std::cout << "  cng           (BCrypt provider unavailable)\n";
+    }
+#endif
+
+    std::cout << "XXH3-128 (selected kernel: " << g_xxh3_kernels.name << ")\n";
+    {
+        Xxh3_128 kat;
+        kat.update(reinterpret_cast<const uint8_t*>("abc"), 3);
+        uint8_t d[16];
+        kat.finish(d);
+        std::cout << "  known-answer test: " << (bytes_to_hex(d, 16) == "06b05ab6733a618578af5f94892f3950" ? "ok" : "FAILED") << "\n";
+    }
+    auto run_xxh3 = [&](Xxh3Kernels k, uint8_t out[16]) {
+        Xxh3_128 h; h.k = k;
+        h.update(data.data(), data.size());
+        h.finish(out);
+    };
+    uint8_t xref[16];
+    secs = timed([&]{ run_xxh3({ xxh3_accumulate_scalar, xxh3_scramble_scalar, "scalar" }, xref); });
+    report("scalar", secs, "");
+#ifdef SYNC_X86_64
+    {
+        uint8_t d[16];
+        secs = timed([&]{ run_xxh3({ xxh3_accumulate_sse2, xxh3_scramble_sse2, "sse2" }, d); });
+        report("sse2", secs, std::memcmp(d, xref, 16) == 0 ? "matches scalar" : "MISMATCH");
+        if (cpu_features().avx2) {
+            secs = timed([&]{ run_xxh3({ xxh3_accumulate_avx2, xxh3_scramble_avx2, "avx2" }, d); });
+            report("avx2", secs, std::memcmp(d, xref, 16) == 0 ? "matches scalar" : "MISMATCH");
+        }
+    }
+#endif
+
+    std::cout << "BLAKE3\n";
+    {
+        Blake3 kat;
+        kat.update(reinterpret_cast<const uint8_t*>("abc"), 3);
+        uint8_t d[32];
+        kat.finish(d);
+        std::cout << "  known-answer test: " << (hex_of(d) == "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85" ? "ok" : "FAILED") << "\n";
+    }
+    auto run_blake3 = [&](bool wide, uint8_t out[32]) {
+        Blake3 h; h.wide = wide;
+        h.update(data.data(), data.size());
+        h.finish(out);
+    };
+    uint8_t bref[32];
+    secs = timed([&]{ run_blake3(false, bref); });
+    report("portable", secs, "");
+#ifdef SYNC_X86_64
+    if (cpu_features().avx2) {
+        uint8_t d[32];
+        secs = timed([&]{ run_blake3(true, d); });
+        report("avx2-x8", secs, std::memcmp(d, bref, 32) == 0 ? "matches portable" : "MISMATCH");
+    }
+#endif
+}
+
+// --bench-read <file>: hashes one file (XXH3-128, so the reader is the
+// bottleneck) through std::ifstream, pread and mmap, each with the file's
+// pages dropped from the page cache first (cold) and already cached (hot).
+static bool drop_file_cache(const fs::path& p) {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    ::fdatasync(fd); // only clean pages can be dropped
+    bool ok = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return ok;
+#else
+    (void)p;
+    return false;
+#endif
+}
+
+static void run_read_benchmark(const fs::path& file) {
+    std::error_code ec;
+    uint64_t bytes = fs::file_size(file, ec);
+    if (ec || bytes == 0) {
+        std::cout << "Cannot benchmark '" << file.string() << "': not a readable, non-empty file.\n";
+        return;
+    }
+
+    auto via_ifstream = [&](uint8_t out[16]) {
+        Xxh3_128 h;
+        std::ifstream in(file, std::ios::binary);
+        std::vector<uint8_t>& buf = hash_read_buffer();
+        while (in.good()) {
+            in.read(reinterpret_cast<char*>(buf.data()), (std::streamsize)buf.size());
+            if (in.gcount() > 0) h.update(buf.data(), (size_t)in.gcount());
+        }
+        h.finish(out);
+        return !in.bad();
+    };
+    auto via_reader = [&](ReadMode mode, uint8_t out[16], bool& mapped) {
+        Xxh3_128 h;
+        FileReader in;
+        if (!in.open(file, mode)) return false;
+        mapped = in.mapped();
+        if (!in.read_range(0, in.size(), [&h](const uint8_t* p, size_t n) { h.update(p, n); })) return false;
+        h.finish(out);
+        return true;
+    };
+
+    struct Method { const char* name; ReadMode mode; };
+    const Method methods[] = { { "ifstream", ReadMode::Auto }, { "pread", ReadMode::Pread }, { "mmap", ReadMode::Mmap } };
+    uint8_t ref[16];
+    bool have_ref = false;
+    bool cold_ok = drop_file_cache(file);
+
+    std::cout << "Read throughput for " << file.string() << " (" << (bytes >> 20) << " MiB, XXH3-128, one thread)\n";
+    std::cout << "  " << std::left << std::setw(12) << "method" << std::right << std::setw(12) << "cold GB/s"
+              << std::setw(12) << "hot GB/s" << "\n";
+    for (const Method& m : methods) {
+        double best[2] = { 0, 0 };
+        bool ok = true, mapped = false;
+        for (int hot = 0; hot < 2; ++hot) {
+            if (!hot && !cold_ok) continue;
+            for (int rep = 0; rep < 3 && ok; ++rep) {
+                if (!hot) drop_file_cache(file);
+                else if (rep == 0) { uint8_t warm[16]; via_ifstream(warm); }
+                uint8_t d[16];
+                auto t0 = std::chrono::steady_clock::now();
+                bool r = std::strcmp(m.name, "ifstream") == 0 ? via_ifstream(d) : via_reader(m.mode, d, mapped);
+                double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                if (!r) { ok = false; break; }
+                if (!have_ref) { std::memcpy(ref, d, 16); have_ref = true; }
+                else if (std::memcmp(ref, d, 16) != 0) ok = false;
+                if (secs > 0) best[hot] = std::max(best[hot], (double)bytes / secs / 1e9);
+            }
+        }
+        std::cout << "  " << std::left << std::setw(12) << m.name << std::right << std::fixed << std::setprecision(2);
+        if (cold_ok) std::cout << std::setw(12) << best[0]; else std::cout << std::setw(12) << "n/a";
+        std::cout << std::setw(12) << best[1];
+        if (!ok) std::cout << "  [READ ERROR OR MISMATCH]";
+        else if (m.mode == ReadMode::Mmap && !mapped) std::cout << "  [mapping unavailable, used pread]";
+        std::cout << "\n";
+    }
+    if (!cold_ok) std::cout << "  (cold runs need posix_fadvise(DONTNEED); not available on this platform)\n";
+}
+
+// ========== Sampled fingerprint tier ==========
+// Files up to SAMPLE_WHOLE_FILE_MAX are hashed completely. Larger files are
+// represented by sample_block_count(size) blocks of SAMPLE_BLOCK bytes at fixed
+// offsets from the first to the last byte, so edits anywhere in a VM image or
+// dump have a fair chance of being seen without reading the whole file. The
+// file size is hashed too, so different sizes never share a digest.
+static const uint64_t SAMPLE_BLOCK = 64 * 1024;
+static const uint64_t SAMPLE_WHOLE_FILE_MAX = 1024 * 1024;
+static const uint64_t SAMPLE_MAX_BLOCKS = 256;
+
+struct SampledFingerprint {
+    Digest digest;          // empty when unreadable or empty
+    bool complete = false;  // every byte of the file went into the digest
+};
+
+// Twice the square root of the size in MiB: 4 blocks for small files, 64 for
+// 1 GiB, capped at 256 blocks (16 MiB of reads) for the largest images.
+static uint64_t sample_block_count(uint64_t size) {
+    uint64_t n = 2 * (uint64_t)std::ceil(std::sqrt((double)(size >> 20)));
+    return std::min(SAMPLE_MAX_BLOCKS, std::max<uint64_t>(4, n));
+}
+
+struct SampleRange {
+    uint64_t off;
+    uint32_t len;
+};
+
+// The reads behind a sampled fingerprint, in hashing order: a small file in
+// SAMPLE_BLOCK pieces, otherwise sample_block_count(size) blocks. Returns
+// whether the ranges cover the whole file.
+static bool sample_plan(uint64_t size, std::vector<SampleRange>& ranges) {
+    ranges.clear();
+    if (size <= SAMPLE_WHOLE_FILE_MAX) {
+        for (uint64_t off = 0; off < size; off += SAMPLE_BLOCK)
+            ranges.push_back({ off, (uint32_t)std::min(SAMPLE_BLOCK, size - off) });
+        return true;
+    }
+    uint64_t n = sample_block_count(size);
+    uint64_t span = size - SAMPLE_BLOCK;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t off = span * i / (n - 1);
+        if (i + 1 < n) off &= ~(uint64_t)4095; // page-aligned, except the tail block
+        ranges.push_back({ off, (uint32_t)SAMPLE_BLOCK });
+    }
+    return false;
+}
+
+// The size goes into the digest first, so files of different sizes never match.
+static void sample_hash_begin(Xxh3_128& h, uint64_t size) {
+    uint8_t size_le[8];
+    for (int i = 0; i < 8; ++i) size_le[i] = (uint8_t)(size >> (8 * i));
+    h.update(size_le, sizeof(size_le));
+}
+
+static void sample_hash_finish(Xxh3_128& h, SampledFingerprint& out) {
+    out.digest.algo = HashAlgo::Sampled;
+    out.digest.len = 16;
+    h.finish(out.digest.bytes);
+}
+
+static SampledFingerprint compute_file_sampled(const fs::path& path) {
+    SampledFingerprint out;
+    FileReader f;
+    if (!f.open(path, ReadMode::Pread, false)) return out;
+    uint64_t size = f.size();
+    if (size == 0) return out;
+
+    Xxh3_128 h;
+    sample_hash_begin(h, size);
+    std::vector<SampleRange> ranges;
+    bool complete = sample_plan(size, ranges);
+    auto feed = [&h](const uint8_t* p, size_t n) { h.update(p, n); };
+    for (const SampleRange& r : ranges) {
+        if (!f.read_range(r.off, r.len, feed)) return out;
+    }
+    out.complete = complete;
+    sample_hash_finish(h, out);
+    return out;
+}
+
+// The same fingerprint for file contents already in memory.
+static SampledFingerprint compute_buffer_sampled(const uint8_t* p, size_t size) {
+    SampledFingerprint out;
+    if (size == 0) return out;
+    Xxh3_128 h;
+    sample_hash_begin(h, size);
+    std::vector<SampleRange> ranges;
+    out.complete = sample_plan(size, ranges);
+    for (const SampleRange& r : ranges) h.update(p + r.off, r.len);
+    sample_hash_finish(h, out);
+    return out;
+}
+
+// ========== io_uring read pipeline ==========
+// Sampled fingerprints for a batch of files from a single submitting thread.
+// The sample reads of up to URING_OPEN_FILES files are kept in flight together
+// through io_uring (uring_queue_depth() reads at a time) and every completed
+// block is fed to its file's hash in order, so an NVMe device sees a deep queue
+// instead of one blocking pread at a time. The digests are identical to
+// compute_file_sampled. Linux only, through the raw syscalls; when the kernel
+// has no io_uring or no IORING_OP_READ (or a sandbox forbids it), or with
+// --no-io-uring, fingerprints come from the pread workers instead.
+static bool g_io_uring_enabled = true; // --no-io-uring
+static const size_t URING_MIN_BATCH = 16;
+static const size_t URING_OPEN_FILES = 64;
+
+static unsigned uring_queue_depth() {
+    if (g_minimum_speed) return 4;
+    if (g_ultra_speed) return 256;
+    return 64;
+}
+
+#ifdef SYNC_HAVE_IO_URING
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    ~IoUring() { close(); }
+
+    // Sets up a ring of `depth` entries and checks that IORING_OP_READ works.
+    bool init(unsigned depth) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        int f = (int)syscall(__NR_io_uring_setup, depth, &p);
+        if (f < 0) return false;
+        fd = f;
+        sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+        void* sq = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) { close(); return false; }
+        sq_ring = sq;
+        void* cq = single ? sq : ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { close(); return false; }
+        cq_ring = cq;
+        sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        void* e = ::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (e == MAP_FAILED) { close(); return false; }
+        sqes = static_cast<io_uring_sqe*>(e);
+
+        char* sqp = static_cast<char*>(sq_ring);
+        sq_head = reinterpret_cast<unsigned*>(sqp + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(sqp + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sqp + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sqp + p.sq_off.array);
+        sq_entries = p.sq_entries;
+        local_tail = *sq_tail;
+        char* cqp = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cqp + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cqp + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cqp + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cqp + p.cq_off.cqes);
+
+        std::vector<uint8_t> probe_buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_buf.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+            probe->last_op < IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (sqes) ::munmap(sqes, sqes_len);
+        if (cq_ring && cq_ring != sq_ring) ::munmap(cq_ring, cq_len);
+        if (sq_ring) ::munmap(sq_ring, sq_len);
+        sqes = nullptr; sq_ring = cq_ring = nullptr;
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    unsigned capacity() const { return sq_entries; }
+
+    // Queues a read; false when the submission queue is full.
+    bool queue_read(int file, void* buf, uint32_t len, uint64_t off, uint64_t user_data) {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) return false;
+        unsigned i = local_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[i];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = off;
+        sqe->user_data = user_data;
+        sq_array[i] = i;
+        ++local_tail;
+        ++queued;
+        return true;
+    }
+
+    // Hands queued reads to the kernel and waits for at least wait_nr
+    // completions. False on an unexpected io_uring_enter error.
+    bool submit(unsigned wait_nr) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        for (;;) {
+            long r = syscall(__NR_io_uring_enter, fd, queued, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (r >= 0) { queued -= (unsigned)std::min<long>(r, queued); return true; }
+            if (errno == EINTR) continue;
+            // transient shortage; the completion queue (twice the submission
+            // queue) can't overflow since reads in flight never exceed capacity()
+            if (errno == EAGAIN || errno == EBUSY) { std::this_thread::yield(); continue; }
+            return false;
+        }
+    }
+
+    // Calls fn(user_data, res) for every available completion.
+    template <class F>
+    void reap(F&& fn) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe& c = cqes[head & cq_mask];
+            fn(c.user_data, c.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Recovery after a failed submit(): withdraws the reads the kernel hasn't
+    // picked up yet and waits until the ones it has (out of `inflight`) have
+    // completed, so their buffers and fds can be released safely.
+    void drain(unsigned inflight) {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        unsigned unsent = std::min(local_tail - head, inflight);
+        local_tail = head;
+        queued = 0;
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned left = inflight - unsent;
+        while (left > 0) {
+            reap([&](uint64_t, int) { if (left > 0) --left; });
+            if (left > 0 && syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+private:
+    int fd = -1;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0;
+    unsigned local_tail = 0, queued = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+static bool io_uring_usable() {
+    IoUring ring;
+    return ring.init(8);
+}
+
+// Fills out[i] with the sampled fingerprint of paths[i]. Returns false only
+// when no ring could be set up (nothing has been read then). Files whose reads
+// fail on the ring are retried through compute_file_sampled.
+static bool uring_sampled_fingerprints(const std::vector<fs::path>& paths, std::vector<SampledFingerprint>& out) {
+    IoUring ring;
+    if (!ring.init(uring_queue_depth())) return false;
+    const unsigned depth = ring.capacity();
+    out.assign(paths.size(), SampledFingerprint());
+
+    // one SAMPLE_BLOCK buffer per in-flight read
+    std::vector<uint8_t> pool((size_t)depth * SAMPLE_BLOCK);
+    std::vector<unsigned> free_bufs;
+    for (unsigned b = depth; b-- > 0; ) free_bufs.push_back(b);
+    auto buf_ptr = [&](int b) { return pool.data() + (size_t)b * SAMPLE_BLOCK; };
+
+    struct Job {
+        bool active = false;
+        size_t idx = 0;
+        int fd = -1;
+        uint64_t size = 0;
+        std::vector<SampleRange> ranges;
+        std::vector<int> ready;  // buffer holding each completed range, -1 until then
+        size_t submitted = 0, fed = 0;
+        unsigned inflight = 0;
+        bool complete = false, failed = false;
+        Xxh3_128 h;
+    };
+    std::vector<Job> jobs(std::min(URING_OPEN_FILES, paths.size()));
+    size_t next_path = 0;
+    unsigned inflight = 0;
+
+    auto start_job = [&](Job& j) {
+        j.active = false;
+        while (next_path < paths.size()) {
+            size_t idx = next_path++;
+            int f = open_source(paths[idx]);
+            if (f < 0) continue; // unreadable: empty fingerprint, as compute_file_sampled
+            struct stat st;
+            if (::fstat(f, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { ::close(f); continue; }
+            j.active = true;
+            j.idx = idx;
+            j.fd = f;
+            j.size = (uint64_t)st.st_size;
+            j.complete = sample_plan(j.size, j.ranges);
+            j.ready.assign(j.ranges.size(), -1);
+            j.submitted = j.fed = 0;
+            j.inflight = 0;
+            j.failed = false;
+            j.h = Xxh3_128();
+            sample_hash_begin(j.h, j.size);
+#ifdef POSIX_FADV_RANDOM
+            if (!j.complete) ::posix_fadvise(f, 0, 0, POSIX_FADV_RANDOM);
+#endif
+            return;
+        }
+    };
+    auto finish_job = [&](Job& j) {
+        for (int& b : j.ready) if (b >= 0) { free_bufs.push_back((unsigned)b); b = -1; }
+        drop_read_cache(j.fd, 0, 0);
+        ::close(j.fd);
+        j.fd = -1;
+        if (j.failed) out[j.idx] = compute_file_sampled(paths[j.idx]);
+        else {
+            out[j.idx].complete = j.complete;
+            sample_hash_finish(j.h, out[j.idx]);
+        }
+        start_job(j);
+    };
+
+    for (auto& j : jobs) start_job(j);
+    for (;;) {
+        // queue reads round-robin across the open files while buffers last
+        bool queued_any = true;
+        while (queued_any && !free_bufs.empty()) {
+            queued_any = false;
+            for (size_t s = 0; s < jobs.size() && !free_bufs.empty(); ++s) {
+                Job& j = jobs[s];
+                if (!j.active || j.failed || j.submitted == j.ranges.size()) continue;
+                const SampleRange& r = j.ranges[j.submitted];
+                unsigned b = free_bufs.back();
+                uint64_t tag = ((uint64_t)s << 32) | (uint64_t)j.submitted;
+                if (!ring.queue_read(j.fd, buf_ptr((int)b), r.len, r.off, tag)) break;
+                g_throttle.acquire(r.len);
+                free_bufs.pop_back();
+                j.ready[j.submitted] = -2 - (int)b; // in flight in buffer b
+                ++j.submitted;
+                ++j.inflight;
+                ++inflight;
+                queued_any = true;
+            }
+        }
+        if (inflight == 0) break;
+        if (!ring.submit(1)) {
+            // wait out the reads already in the kernel before the pool and
+            // the fds they target go away, then redo everything synchronously
+            ring.drain(inflight);
+            for (auto& j : jobs) if (j.active) { if (j.fd >= 0) ::close(j.fd); j.active = false; }
+            for (size_t i = 0; i < paths.size(); ++i) out[i] = compute_file_sampled(paths[i]);
+            return true;
+        }
+        ring.reap([&](uint64_t tag, int res) {
+            Job& j = jobs[(size_t)(tag >> 32)];
+            size_t r = (size_t)(tag & 0xffffffffu);
+            int b = -2 - j.ready[r];
+            --j.inflight;
+            --inflight;
+            if (res != (int)j.ranges[r].len) {
+                j.failed = true;
+                j.ready[r] = -1;
+                free_bufs.push_back((unsigned)b);
+                return;
+            }
+            j.ready[r] = b;
+            while (!j.failed && j.fed < j.ranges.size() && j.ready[j.fed] >= 0) {
+                j.h.update(buf_ptr(j.ready[j.fed]), j.ranges[j.fed].len);
+                free_bufs.push_back((unsigned)j.ready[j.fed]);
+                j.ready[j.fed] = -1;
+                ++j.fed;
+            }
+        });
+        for (auto& j : jobs) {
+            if (!j.active || j.inflight > 0) continue;
+            if (j.failed || j.fed == j.ranges.size()) finish_job(j);
+        }
+    }
+    return true;
+}
+#endif
+
+// Whether a file of this size gets the full-content hash, i.e. falls inside the
+// --sha256-min/--sha256-max window. Bounds are enforced only if they were
+// explicitly set by the user; if neither is set, the full hash applies to all files.
+static bool full_hash_applies_to_size(uint64_t sz) {
+    if (g_sha256_min_set && sz < g_sha256_min_bytes) return false; // smaller than requested minimum -> sampled only
+    if (g_sha256_max_set && sz > g_sha256_max_bytes) return false; // larger than requested maximum -> sampled only
+    return true;
+}
+
+static bool wants_full_hash(const fs::path& p) {
+    if (!g_use_content_hash || g_hash_algo == HashAlgo::Sampled) return false;
+    std::error_code ec;
+    uintmax_t fsize = fs::file_size(p, ec);
+    return !ec && full_hash_applies_to_size(static_cast<uint64_t>(fsize));
+}
+
+// ========== Fingerprint cache ==========
+// Digests persisted across runs in FP_CACHE_NAME at the destination root, so
+// files that have not changed since the last run are not read again. Entries
+// are keyed by (device, inode, algorithm) and only trusted while size, mtime
+// and ctime (nanoseconds) still match the file. The whole table is loaded at
+// start-up and rewritten at the end of the run through a temp file + rename,
+// so an interrupted run leaves the previous cache intact.
+//
+// On-disk layout (little-endian): 8-byte magic, u64 record count, then
+// FP_CACHE_RECORD-byte records:
+//   dev u64 | ino u64 | size u64 | mtime_ns i64 | ctime_ns i64 |
+//   algo u8 | digest len u8 | flags u8 (bit 0: complete) | pad[5] | digest[32]
+static const std::string INTERNAL_FILE_PREFIX = ".synceverything-";
+static const std::string FP_CACHE_NAME = INTERNAL_FILE_PREFIX + "fpcache";
+static const char FP_CACHE_MAGIC[8] = { 'S', 'E', 'F', 'P', 'C', 'A', '0', '1' };
+static const size_t FP_CACHE_RECORD = 80;
+static bool g_fp_cache_enabled = true; // --no-fp-cache
+
+// Files the tool keeps in the destination for its own use; never synced,
+// indexed or deleted by mirror mode.
+static bool is_internal_file(const fs::path& p) {
+    return p.filename().string().rfind(INTERNAL_FILE_PREFIX, 0) == 0;
+}
+
+struct FileStamp {
+    uint64_t dev = 0, ino = 0, size = 0;
+    int64_t mtime_ns = 0, ctime_ns = 0;
+};
+
+#ifndef _WIN32
+static void stamp_from_stat(const struct stat& st, FileStamp& out) {
+    out.dev = (uint64_t)st.st_dev;
+    out.ino = (uint64_t)st.st_ino;
+    out.size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    out.mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+    out.ctime_ns = (int64_t)st.st_ctimespec.tv_sec * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+    out.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    out.ctime_ns = (int64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+}
+#endif
+
+static bool file_stamp(const fs::path& p, FileStamp& out) {
+#ifdef _WIN32
+    HANDLE h = CreateFileW(p.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    FILE_BASIC_INFO basic;
+    bool ok = GetFileInformationByHandle(h, &info) &&
+              GetFileInformationByHandleEx(h, FileBasicInfo, &basic, sizeof(basic));
+    CloseHandle(h);
+    if (!ok) return false;
+    out.dev = info.dwVolumeSerialNumber;
+    out.ino = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    out.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    out.mtime_ns = basic.LastWriteTime.QuadPart * 100; // 100 ns FILETIME ticks
+    out.ctime_ns = basic.ChangeTime.QuadPart * 100;
+    return true;
+#else
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    stamp_from_stat(st, out);
+    return true;
+#endif
+}
+
+static void store_le64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+#ifdef _WIN32
+static bool flush_file(const fs::path& p); // see Durable writes
+#endif
+
+class FingerprintCache {
+    struct Key {
+        uint64_t dev, ino;
+        HashAlgo algo;
+        bool operator==(const Key& o) const { return dev == o.dev && ino == o.ino && algo == o.algo; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const noexcept {
+            return (size_t)(k.ino * 0x9E3779B97F4A7C15ull ^ k.dev ^ ((uint64_t)k.algo << 59));
+        }
+    };
+    struct Entry {
+        uint64_t size;
+        int64_t mtime_ns, ctime_ns;
+        Digest digest;
+        bool complete;
+        bool seen; // looked up or stored during this run
+    };
+
+    std::mutex m;
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    fs::path file;
+    bool active = false;
+    bool dirty = false;
+    bool prune = false;
+
+public:
+    std::atomic<uint64_t> hits{0}, misses{0};
+
+    bool enabled() const { return active; }
+
+    // Loads the cache stored at `path`. A missing, truncated or foreign file
+    // simply starts an empty cache.
+    void load(const fs::path& path) {
+        std::lock_guard<std::mutex> lk(m);
+        file = path;
+        active = true;
+        entries.clear();
+        std::ifstream in(path, std::ios::binary);
+        if (!in) return;
+        uint8_t head[16];
+        if (!in.read(reinterpret_cast<char*>(head), sizeof(head))) return;
+        if (std::memcmp(head, FP_CACHE_MAGIC, 8) != 0) return;
+        uint64_t count = read_le64(head + 8);
+        std::vector<uint8_t> rec(FP_CACHE_RECORD);
+        entries.reserve((size_t)std::min<uint64_t>(count, 1u << 24));
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!in.read(reinterpret_cast<char*>(rec.data()), (std::streamsize)rec.size())) break;
+            const uint8_t* r = rec.data();
+            uint8_t algo = r[40], len = r[41];
+            if (algo > (uint8_t)HashAlgo::Blake3 || len == 0 || len > sizeof(Digest::bytes)) continue;
+            Entry e;
+            e.size = read_le64(r + 16);
+            e.mtime_ns = (int64_t)read_le64(r + 24);
+            e.ctime_ns = (int64_t)read_le64(r + 32);
+            e.digest.algo = (HashAlgo)algo;
+            e.digest.len = len;
+            std::memcpy(e.digest.bytes, r + 48, len);
+            e.complete = (r[42] & 1) != 0;
+            e.seen = false;
+            entries[Key{ read_le64(r), read_le64(r + 8), e.digest.algo }] = e;
+        }
+    }
+
+    // `count` = false looks without counting a hit or miss (copies peeking at
+    // what the scan already knows).
+    bool lookup(const FileStamp& st, HashAlgo algo, Digest& d, bool& complete, bool count = true) {
+        if (!active) return false;
+        std::lock_guard<std::mutex> lk(m);
+        auto it = entries.find(Key{ st.dev, st.ino, algo });
+        if (it == entries.end() || it->second.size != st.size ||
+            it->second.mtime_ns != st.mtime_ns || it->second.ctime_ns != st.ctime_ns) {
+            if (count) misses++;
+            return false;
+        }
+        it->second.seen = true;
+        d = it->second.digest;
+        complete = it->second.complete;
+        if (count) hits++;
+        return true;
+    }
+
+    void store(const FileStamp& st, const Digest& d, bool complete) {
+        if (!active || d.empty()) return;
+        std::lock_guard<std::mutex> lk(m);
+        entries[Key{ st.dev, st.ino, d.algo }] = Entry{ st.size, st.mtime_ns, st.ctime_ns, d, complete, true };
+        dirty = true;
+    }
+
+    // Called once the whole destination has been fingerprinted: entries not
+    // touched by this run belong to files that are gone and are dropped on save.
+    void prune_unseen_on_save() {
+        std::lock_guard<std::mutex> lk(m);
+        prune = true;
+    }
+
+    // Writes the table to a temp file next to the cache, flushes it to disk
+    // and renames it into place. Entries modified within FP_CACHE_RACY_NS of the write are left
+    // out: a later same-size write in the same timestamp tick would otherwise
+    // go unnoticed.
+    bool save() {
+        static const int64_t FP_CACHE_RACY_NS = 2000000000LL;
+        std::lock_guard<std::mutex> lk(m);
+        if (!active || (!dirty && !prune)) return true;
+        std::error_code ec;
+        if (!fs::is_directory(file.parent_path(), ec)) return false;
+        fs::path tmp = file;
+        tmp += ".tmp";
+#ifdef _WIN32
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        out.flush();
+#else
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0) return false;
+#endif
+        // the temp file's mtime gives "now" in the destination's own clock
+        FileStamp now;
+        int64_t racy_after = file_stamp(tmp, now) ? now.mtime_ns - FP_CACHE_RACY_NS : INT64_MAX;
+
+        std::vector<uint8_t> buf(16);
+        std::memcpy(buf.data(), FP_CACHE_MAGIC, 8);
+        uint64_t count = 0;
+        for (const auto& kv : entries) {
+            const Entry& e = kv.second;
+            if (prune && !e.seen) continue;
+            if (e.mtime_ns >= racy_after || e.ctime_ns >= racy_after) continue;
+            size_t at = buf.size();
+            buf.resize(at + FP_CACHE_RECORD, 0);
+            uint8_t* r = buf.data() + at;
+            store_le64(r, kv.first.dev);
+            store_le64(r + 8, kv.first.ino);
+            store_le64(r + 16, e.size);
+            store_le64(r + 24, (uint64_t)e.mtime_ns);
+            store_le64(r + 32, (uint64_t)e.ctime_ns);
+            r[40] = (uint8_t)e.digest.algo;
+            r[41] = e.digest.len;
+            r[42] = e.complete ? 1 : 0;
+            std::memcpy(r + 48, e.digest.bytes, e.digest.len);
+            ++count;
+        }
+        store_le64(buf.data() + 8, count);
+        // the new table must be on disk before the rename replaces the old one
+#ifdef _WIN32
+        out.write(reinterpret_cast<const char*>(buf.data()), (std::streamsize)buf.size());
+        out.close();
+        bool ok = out && flush_file(tmp);
+#else
+        bool ok = true;
+        for (size_t done = 0; ok && done < buf.size();) {
+            ssize_t w = ::write(fd, buf.data() + done, buf.size() - done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) ok = false;
+            else done += (size_t)w;
+        }
+        ok = ok && ::fdatasync(fd) == 0;
+        if (::close(fd) != 0) ok = false;
+#endif
+        if (!ok) { fs::remove(tmp, ec); return false; }
+        fs::rename(tmp, file, ec);
+        if (ec) { fs::remove(tmp, ec); return false; }
+#ifndef _WIN32
+        int dfd = ::open(file.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0) {
+            ::fsync(dfd);
+            ::close(dfd);
+        }
+#endif
+        dirty = false;
+        return true;
+    }
+};
+
+static FingerprintCache g_fp_cache;
+
+// Sampled fingerprint through the cache.
+static SampledFingerprint file_sampled_fingerprint(const fs::path& p) {
+    FileStamp st;
+    bool stamped = g_fp_cache.enabled() && file_stamp(p, st);
+    SampledFingerprint out;
+    if (stamped && g_fp_cache.lookup(st, HashAlgo::Sampled, out.digest, out.complete)) return out;
+    out = compute_file_sampled(p);
+    if (stamped) g_fp_cache.store(st, out.digest, out.complete);
+    return out;
+}
+
+// Log form of a fingerprint: "<algo>:<hex>", e.g. "sha256:ba78...".
+static std::string fingerprint_to_string(const Digest& d) {
+    if (d.empty()) return "(none)";
+    return std::string(hash_algo_name(d.algo)) + ":" + bytes_to_hex(d.bytes, d.len);
+}
+
+// Runs fn(i) for every i in [0, n) on up to `workers` threads. Indices are
+// handed out in small batches from a shared counter, so a few huge files don't
+// leave the other threads idle behind a static partition.
+static void parallel_for_index(size_t n, int workers, const std::function<void(size_t)>& fn, size_t batch = 16) {
+    const size_t BATCH = std::max<size_t>(1, batch);
+    size_t max_workers = (n + BATCH - 1) / BATCH;
+    size_t nthreads = std::min<size_t>(std::max(1, workers), max_workers);
+    if (nthreads <= 1) {
+        for (size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (;;) {
+            size_t begin = next.fetch_add(BATCH);
+            if (begin >= n) return;
+            size_t end = std::min(n, begin + BATCH);
+            for (size_t i = begin; i < end; ++i) fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    for (size_t t = 1; t < nthreads; ++t) threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads) t.join();
+}
+
+// Tier 1 for many files: the sampled fingerprints that key the destination
+// index. Cache lookups run on the copy concurrency
+// budget (--ultra-speed / --minimum-speed); the misses are read through the
+// io_uring pipeline when it is available, otherwise hashed by the same pool of
+// pread workers. Every worker writes only its own slots, so no locking is
+// needed beyond the fingerprint cache's.
+static std::vector<Digest> file_fingerprints(const std::vector<fs::path>& paths) {
+    const size_t n = paths.size();
+    std::vector<Digest> out(n);
+    std::vector<FileStamp> stamps(n);
+    std::vector<char> stamped(n, 0), hit(n, 0);
+    if (g_fp_cache.enabled()) {
+        parallel_for_index(n, g_max_concurrent_copies, [&](size_t i) {
+            bool complete;
+            stamped[i] = file_stamp(paths[i], stamps[i]);
+            hit[i] = stamped[i] && g_fp_cache.lookup(stamps[i], HashAlgo::Sampled, out[i], complete);
+        });
+    }
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < n; ++i) if (!hit[i]) todo.push_back(i);
+
+    std::vector<SampledFingerprint> fps(todo.size());
+    bool done = false;
+#ifdef SYNC_HAVE_IO_URING
+    if (g_io_uring_enabled && todo.size() >= URING_MIN_BATCH) {
+        std::vector<fs::path> todo_paths;
+        todo_paths.reserve(todo.size());
+        for (size_t i : todo) todo_paths.push_back(paths[i]);
+        done = uring_sampled_fingerprints(todo_paths, fps);
+        if (!done) g_io_uring_enabled = false; // no ring here; don't try again
+    }
+#endif
+    if (!done) {
+        parallel_for_index(todo.size(), g_max_concurrent_copies, [&](size_t k) {
+            fps[k] = compute_file_sampled(paths[todo[k]]);
+        });
+    }
+    for (size_t k = 0; k < todo.size(); ++k) {
+        size_t i = todo[k];
+        out[i] = fps[k].digest;
+        if (stamped[i]) g_fp_cache.store(stamps[i], fps[k].digest, fps[k].complete);
+    }
+    return out;
+}
+
+// Tier 2: full-content fingerprints of g_hash_algo, served from the cache where
+// possible. With SHA-256 the remaining files are hashed together so the
+// multi-buffer engine can interleave them.
+static std::vector<Digest> full_fingerprints(const std::vector<fs::path>& paths) {
+    std::vector<Digest> out(paths.size());
+    std::vector<FileStamp> stamps(paths.size());
+    std::vector<bool> stamped(paths.size(), false);
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        bool complete;
+        stamped[i] = g_fp_cache.enabled() && file_stamp(paths[i], stamps[i]);
+        if (stamped[i] && g_fp_cache.lookup(stamps[i], g_hash_algo, out[i], complete)) continue;
+        todo.push_back(i);
+    }
+    if (todo.empty()) return out;
+
+    std::vector<fs::path> todo_paths;
+    for (size_t i : todo) todo_paths.push_back(paths[i]);
+    std::vector<Digest> computed;
+    if (g_hash_algo == HashAlgo::Sha256) computed = compute_files_sha256(todo_paths);
+    else for (const auto& fp : todo_paths) computed.push_back(compute_file_digest(fp, g_hash_algo));
+    for (size_t k = 0; k < todo.size(); ++k) {
+        size_t i = todo[k];
+        out[i] = computed[k];
+        if (stamped[i]) g_fp_cache.store(stamps[i], out[i], true);
+    }
+    return out;
+}
+
+// Escalation step for two files whose sampled fingerprints matched: if the
+// samples did not cover the whole file and a full-content algorithm applies,
+// compare full digests; otherwise the sampled match stands.
+static bool confirm_sampled_match(const fs::path& a, const fs::path& b, bool sampled_complete) {
+    if (sampled_complete || !wants_full_hash(a)) return true;
+    std::vector<Digest> full = full_fingerprints({a, b});
+    return !full[0].empty() && full[0] == full[1];
+}
+
+// Content comparison for two files of equal size: sampled first, escalating only
+// when the samples agree.
+static bool files_have_same_content(const fs::path& a, const fs::path& b) {
+    SampledFingerprint sa = file_sampled_fingerprint(a);
+    SampledFingerprint sb = file_sampled_fingerprint(b);
+    if (sa.digest.empty() || sb.digest.empty() || sa.digest != sb.digest) return false;
+    return confirm_sampled_match(a, b, sa.complete);
+}
+
+
+// ========== Logging ==========
+std::mutex logMutex;
+std::ofstream logFile;
+
+void logMsg(const std::string& msg, bool verbose, bool useColor) {
+    { 
+        std::lock_guard<std::mutex> lock(logMutex);
+        if (logFile.is_open()) {
+            auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            logFile << "[" << std::ctime(&now);
+            logFile.seekp(-1, std::ios::cur);
+            logFile << "] " << msg << "\n";
+        }
+    }
+
+    if (verbose) {
+        if (useColor) {
+            std::string final_msg = msg;
+            if (msg.find("[DRY-RUN]") != std::string::npos || msg.find("INFO:") != std::string::npos || msg.find("Would MOVE") != std::string::npos) {
+                final_msg = BOLD_YELLOW + msg + RESET;
+            } 
+            else if (msg.find("SUCCESS!") != std::string::npos || msg.find("Copied") != std::string::npos || msg.find("All Tasks Finished !!") != std::string::npos || msg.find("Renamed") != std::string::npos || msg.find("Deleted:") != std::string::npos) {
+                final_msg = BOLD_GREEN + msg + RESET;
+            }
+            else if (msg.find("[X] ERROR:") != std::string::npos) {
+                final_msg = BOLD_RED + msg + RESET;
+            }
+            else if (msg.find("Ignored:") != std::string::npos) {
+                final_msg = BLUE + msg + RESET;
+            }
+            std::cout << final_msg << std::endl;
+        } else {
+            std::cout << msg << std::endl;
+        }
+    }
+}
+
+// ========== Settings helper ==========
+const std::string SETTINGS_FILE = "settings.json";
+void saveSettings(const std::map<std::string, std::string>& settings) {
+    std::ofstream out(SETTINGS_FILE);
+    out << "{\n";
+    for (auto it = settings.begin(); it != settings.end(); ++it) {
+        out << "  \"" << it->first << "\": \"" << it->second << "\"";
+        if (std::next(it) != settings.end()) out << ",";
+        out << "\n";
+    }
+    out << "}\n";
+}
+std::map<std::string, std::string> loadSettings() {
+    std::map<std::string, std::string> settings;
+    std::ifstream in(SETTINGS_FILE);
+    if (!in.is_open()) return settings;
+    std::string line;
+    while (std::getline(in, line)) {
+        auto keyStart = line.find("\"");
+        auto keyEnd = line.find("\"", keyStart + 1);
+        if (keyStart == std::string::npos || keyEnd == std::string::npos) continue;
+        std::string key = line.substr(keyStart + 1, keyEnd - keyStart - 1);
+        auto valStart = line.find("\"", keyEnd + 1);
+        auto valEnd = line.find("\"", valStart + 1);
+        if (valStart == std::string::npos || valEnd == std::string::npos) continue;
+        std::string val = line.substr(valStart + 1, valEnd - valStart - 1);
+        settings[key] = val;
+    }
+    return settings;
+}
+
+static uint64_t parse_size_arg(const std::string& s, uint64_t default_val = 0) {
+    if (s.empty()) return default_val;
+    try {
+        size_t idx = 0;
+        uint64_t v = std::stoull(s, &idx);
+        if (idx < s.size()) {
+            char suf = (char)std::toupper(s[idx]);
+            if (suf == 'K') v *= 1024ULL;
+            else if (suf == 'M') v *= 1024ULL * 1024ULL;
+            else if (suf == 'G') v *= 1024ULL * 1024ULL * 1024ULL;
+        }
+        return v;
+    } catch (...) {
+        return default_val;
+    }
+}
+
+// Human-readable byte count for summaries ("1.5 GiB").
+static std::string format_bytes(uint64_t n) {
+    static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    double v = (double)n;
+    int u = 0;
+    while (v >= 1024.0 && u < 4) { v /= 1024.0; ++u; }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), u == 0 ? "%.0f %s" : "%.1f %s", v, units[u]);
+    return buf;
+}
+
+// ========== Range copy primitives ==========
+#ifndef _WIN32
+static bool pwrite_all(int fd, const uint8_t* p, size_t n, uint64_t off) {
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, p, n, (off_t)off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w; n -= (size_t)w; off += (uint64_t)w;
+    }
+    return true;
+}
+
+// Plain read/write copy of [in_off, in_off + len) to out_off.
+static bool rw_copy_range(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+    std::vector<uint8_t>& buf = hash_read_buffer();
+    while (len > 0) {
+        size_t want = g_throttle.chunk((size_t)std::min<uint64_t>(len, buf.size()));
+        g_throttle.acquire(want);
+        ssize_t r = ::pread(in, buf.data(), want, (off_t)in_off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        if (!pwrite_all(out, buf.data(), (size_t)r, out_off)) return false;
+        in_off += (uint64_t)r; out_off += (uint64_t)r; len -= (uint64_t)r;
+    }
+    return true;
+}
+
+// In-kernel copy (copy_file_range), which some filesystems turn into a reflink
+// or a server-side copy; falls back to read/write where unsupported.
+static bool kernel_copy_range(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+#ifdef __linux__
+    while (len > 0) {
+        loff_t io = (loff_t)in_off, oo = (loff_t)out_off;
+        size_t want = g_throttle.chunk((size_t)std::min<uint64_t>(len, 1ULL << 30));
+        g_throttle.acquire(want);
+        ssize_t r = ::copy_file_range(in, &io, out, &oo, want, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return rw_copy_range(in, in_off, out, out_off, len);
+        in_off += (uint64_t)r; out_off += (uint64_t)r; len -= (uint64_t)r;
+    }
+    return true;
+#else
+    return rw_copy_range(in, in_off, out, out_off, len);
+#endif
+}
+
+// Shares the extents of [in_off, in_off + len) with out at out_off
+// (FICLONERANGE on Btrfs, XFS, bcachefs...), so no data is written. Offsets
+// must be block aligned; the length too unless the range ends at the end of
+// the input file. Returns false when the filesystem can't do it.
+static bool clone_range(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+#if defined(__linux__) && defined(FICLONERANGE)
+    struct file_clone_range fcr;
+    fcr.src_fd = in;
+    fcr.src_offset = in_off;
+    fcr.src_length = len;
+    fcr.dest_offset = out_off;
+    return ::ioctl(out, FICLONERANGE, &fcr) == 0;
+#else
+    (void)in; (void)in_off; (void)out; (void)out_off; (void)len;
+    return false;
+#endif
+}
+#endif
+
+// Scratch name in the destination directory for a file being rebuilt; never
+// synced or deleted by mirror mode (see is_internal_file).
+static fs::path temp_path_for(const fs::path& dst) {
+    return dst.parent_path() / (INTERNAL_FILE_PREFIX + "tmp-" + dst.filename().string());
+}
+
+// ========== Durable writes ==========
+// Every rewritten file is built under its temp name and renamed over the
+// destination, so readers (and a crash) see either the old or the new file,
+// never a missing or half-written one. --durability decides when data reaches
+// the disk: none leaves it to the OS (the default), end runs one syncfs per
+// destination filesystem when the sync is done, and file does fdatasync before
+// each rename plus an fsync of the directory after it, which is safe per file
+// but slow for many small ones. Windows flushes each file for both end and
+// file, as it has no syncfs.
+enum class Durability { None, End, File };
+static Durability g_durability = Durability::None; // --durability
+
+static bool parse_durability(const std::string& s, Durability& out) {
+    if (s == "none") out = Durability::None;
+    else if (s == "end") out = Durability::End;
+    else if (s == "file") out = Durability::File;
+    else return false;
+    return true;
+}
+
+// Whether a file must reach the disk before it is renamed into place.
+static bool durability_per_file() {
+#ifdef _WIN32
+    return g_durability != Durability::None;
+#else
+    return g_durability == Durability::File;
+#endif
+}
+
+static std::mutex g_dirty_fs_mtx;
+static std::map<uint64_t, fs::path> g_dirty_fs; // st_dev -> a directory on it
+
+// Remembers the filesystem holding dir for the syncfs at the end of the run.
+static void note_dirty_dir(const fs::path& dir) {
+#ifndef _WIN32
+    if (g_durability != Durability::End) return;
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0) return;
+    std::lock_guard<std::mutex> lk(g_dirty_fs_mtx);
+    g_dirty_fs.emplace((uint64_t)st.st_dev, dir);
+#else
+    (void)dir;
+#endif
+}
+
+#ifdef _WIN32
+static bool flush_file(const fs::path& p) {
+    HANDLE h = CreateFileW(p.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    bool ok = FlushFileBuffers(h) != 0;
+    CloseHandle(h);
+    return ok;
+}
+#endif
+
+// Renames a finished temp file over dst and applies the durability mode to
+// the new directory entry. The temp file's data must already be flushed when
+// durability_per_file() says so.
+static bool install_temp_file(const fs::path& tmp, const fs::path& dst, std::error_code& ec) {
+    fs::rename(tmp, dst, ec);
+    if (ec) return false;
+#ifndef _WIN32
+    if (g_durability == Durability::File) {
+        int dfd = ::open(dst.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0) {
+            ::fsync(dfd);
+            ::close(dfd);
+        }
+    }
+#endif
+    note_dirty_dir(dst.parent_path());
+    return true;
+}
+
+// --durability=end: flushes every destination filesystem written to.
+static size_t sync_dirty_filesystems() {
+    std::lock_guard<std::mutex> lk(g_dirty_fs_mtx);
+    size_t n = 0;
+#ifdef __linux__
+    for (const auto& e : g_dirty_fs) {
+        int fd = ::open(e.second.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) continue;
+        if (::syncfs(fd) == 0) ++n;
+        ::close(fd);
+    }
+#elif !defined(_WIN32)
+    if (!g_dirty_fs.empty()) { ::sync(); n = g_dirty_fs.size(); }
+#endif
+    g_dirty_fs.clear();
+    return n;
+}
+
+// ========== Delta transfer ==========
+// rsync-style update of an existing destination file (--delta). The old file
+// is cut into blocks, each with a rolling weak checksum and an XXH3-128 strong
+// checksum; the source is scanned with the rolling checksum and every window
+// that matches an old block is taken from the old file instead of being
+// written again. The result is built in a temp file and renamed over the
+// destination. Reused runs are cloned (FICLONERANGE) when the filesystem
+// shares extents, so only literal data costs writes; otherwise they are copied
+// inside the kernel. Filesystems without reflinks can use --delta-inplace:
+// when every reused block keeps its offset (in-place edits, appends) only the
+// changed ranges are written into the destination itself, which is not
+// crash-atomic. POSIX only; Windows always copies whole files.
+static bool g_delta_enabled = false;                     // --delta
+static bool g_delta_inplace = false;                     // --delta-inplace
+static uint64_t g_delta_min_bytes = 64ULL * 1024 * 1024; // --delta-min
+static std::atomic<uint64_t> g_delta_files{0}, g_delta_literal_bytes{0}, g_delta_reused_bytes{0}, g_delta_cloned_bytes{0};
+
+// About sqrt(size) like rsync, as a power of two between 4 KiB and 1 MiB so
+// unmoved blocks stay aligned for cloning.
+static uint32_t delta_block_size(uint64_t size) {
+    uint64_t b = 4096;
+    while (b < (1u << 20) && b * b < size) b <<= 1;
+    return (uint32_t)b;
+}
+
+// rsync's weak checksum: a = sum of bytes, b = sum of a over the window prefix,
+// both mod 2^16, rollable one byte at a time.
+struct RollingSum {
+    uint32_t a = 0, b = 0, len = 0;
+    void init(const uint8_t* p, uint32_t n) {
+        a = b = 0;
+        len = n;
+        for (uint32_t i = 0; i < n; ++i) { a += p[i]; b += (n - i) * (uint32_t)p[i]; }
+    }
+    void roll(uint8_t out, uint8_t in) {
+        a += (uint32_t)in - (uint32_t)out;
+        b += a - len * (uint32_t)out;
+    }
+    uint32_t value() const { return (a & 0xffff) | (b << 16); }
+};
+
+struct StrongSum {
+    uint64_t lo = 0, hi = 0;
+    bool operator==(const StrongSum& o) const { return lo == o.lo && hi == o.hi; }
+};
+
+static StrongSum strong_sum(const uint8_t* p, size_t n) {
+    Xxh3_128 h;
+    h.update(p, n);
+    uint8_t d[16];
+    h.finish(d);
+    StrongSum s;
+    for (int i = 0; i < 8; ++i) { s.hi = (s.hi << 8) | d[i]; s.lo = (s.lo << 8) | d[8 + i]; }
+    return s;
+}
+
+// One step of the rebuilt file: new[off, off + len) is either literal source
+// data or old[old_off, old_off + len).
+struct DeltaOp {
+    bool reuse;
+    uint64_t off, old_off, len;
+};
+
+#ifndef _WIN32
+class DeltaSignature {
+public:
+    uint32_t block = 0;
+    uint64_t old_size = 0;
+
+    bool build(FileReader& old) {
+        old_size = old.size();
+        block = delta_block_size(old_size);
+        size_t nblocks = (size_t)(old_size / block);
+        weak.resize(nblocks);
+        strong.resize(nblocks);
+        size_t buckets = 1;
+        while (buckets < nblocks * 2) buckets <<= 1;
+        mask = (uint32_t)buckets - 1;
+        heads.assign(buckets, NONE);
+        next.assign(nblocks, NONE);
+        std::vector<uint8_t> buf(block);
+        for (size_t i = 0; i < nblocks; ++i) {
+            if (old.pread_into(buf.data(), block, (uint64_t)i * block) != (long long)block) return false;
+            RollingSum rs;
+            rs.init(buf.data(), block);
+            weak[i] = rs.value();
+            strong[i] = strong_sum(buf.data(), block);
+            uint32_t hb = bucket(weak[i]);
+            next[i] = heads[hb];
+            heads[hb] = (uint32_t)i;
+        }
+        tail_len = old_size - (uint64_t)nblocks * block;
+        if (tail_len > 0) {
+            if (old.pread_into(buf.data(), (size_t)tail_len, old_size - tail_len) != (long long)tail_len) return false;
+            tail_strong = strong_sum(buf.data(), (size_t)tail_len);
+        }
+        return true;
+    }
+
+    // Index of an old block equal to window, preferring `expected` (the block
+    // after the previous match), or -1.
+    long long find(uint32_t w, const uint8_t* window, size_t expected) const {
+        uint32_t i = heads[bucket(w)];
+        if (i == NONE) return -1;
+        StrongSum s;
+        bool have_strong = false;
+        long long found = -1;
+        for (; i != NONE; i = next[i]) {
+            if (weak[i] != w) continue;
+            if (!have_strong) { s = strong_sum(window, block); have_strong = true; }
+            if (strong[i] == s) {
+                if (i == expected) return i;
+                if (found < 0) found = i;
+            }
+        }
+        return found;
+    }
+
+    bool tail_matches(const uint8_t* p, uint64_t n) const {
+        return tail_len > 0 && n == tail_len && strong_sum(p, (size_t)n) == tail_strong;
+    }
+    uint64_t tail_offset() const { return old_size - tail_len; }
+
+private:
+    static constexpr uint32_t NONE = 0xffffffffu;
+    uint32_t bucket(uint32_t w) const { return (uint32_t)((w * 0x9E3779B1u) >> 7) & mask; }
+    std::vector<uint32_t> weak, heads, next;
+    std::vector<StrongSum> strong;
+    uint32_t mask = 0;
+    uint64_t tail_len = 0;
+    StrongSum tail_strong;
+};
+
+static void delta_push(std::vector<DeltaOp>& ops, bool reuse, uint64_t off, uint64_t old_off, uint64_t len) {
+    if (len == 0) return;
+    if (!ops.empty()) {
+        DeltaOp& last = ops.back();
+        if (last.reuse == reuse && last.off + last.len == off && (!reuse || last.old_off + last.len == old_off)) {
+            last.len += len;
+            return;
+        }
+    }
+    ops.push_back({ reuse, off, old_off, len });
+}
+
+// Scans the new file against the signature of the old one.
+static bool delta_scan(FileReader& src, const DeltaSignature& sig, std::vector<DeltaOp>& ops) {
+    const uint32_t B = sig.block;
+    const uint64_t size = src.size();
+    const size_t cap = std::max<size_t>(8u << 20, 4 * (size_t)B);
+    std::vector<uint8_t> buf(cap);
+    uint64_t buf_off = 0; // file offset of buf[0]
+    size_t buf_len = 0, p = 0, lit = 0;
+    bool have_sum = false;
+    RollingSum rs;
+    size_t expected = 0;
+
+    for (;;) {
+        if (p + B + 1 > buf_len && buf_off + buf_len < size) {
+            // keep the window and one byte of lookahead in the buffer
+            delta_push(ops, false, buf_off + lit, 0, p - lit);
+            std::memmove(buf.data(), buf.data() + p, buf_len - p);
+            buf_off += p; buf_len -= p; p = lit = 0;
+            long long r = src.pread_into(buf.data() + buf_len, cap - buf_len, buf_off + buf_len);
+            if (r <= 0) return false;
+            buf_len += (size_t)r;
+            continue;
+        }
+        if (p + B > buf_len) break; // less than a block left
+        if (!have_sum) { rs.init(buf.data() + p, B); have_sum = true; }
+        long long m = sig.find(rs.value(), buf.data() + p, expected);
+        if (m >= 0) {
+            delta_push(ops, false, buf_off + lit, 0, p - lit);
+            delta_push(ops, true, buf_off + p, (uint64_t)m * B, B);
+            p += B; lit = p;
+            have_sum = false;
+            expected = (size_t)m + 1;
+            continue;
+        }
+        if (p + B >= buf_len) { p = buf_len; break; } // last window at end of file
+        rs.roll(buf[p], buf[p + B]);
+        ++p;
+    }
+    if (p < buf_len && lit == p && sig.tail_matches(buf.data() + p, buf_len - p)) {
+        delta_push(ops, true, buf_off + p, sig.tail_offset(), buf_len - p);
+        lit = buf_len;
+    }
+    delta_push(ops, false, buf_off + lit, 0, buf_len - lit);
+    return buf_off + buf_len == size;
+}
+
+// Rebuilds dst from src using the blocks dst already has. False when delta
+// isn't possible or failed; dst is untouched then and a full copy follows.
+static bool delta_copy_file(const fs::path& src, const fs::path& dst) {
+    FileReader in, old;
+    if (!in.open(src, ReadMode::Pread) || !old.open(dst, ReadMode::Pread)) return false;
+    DeltaSignature sig;
+    std::vector<DeltaOp> ops;
+    if (old.size() < delta_block_size(old.size()) || !sig.build(old) || !delta_scan(in, sig, ops)) return false;
+
+    uint64_t literal = 0, reused = 0, cloned = 0;
+    bool in_place_ok = g_delta_inplace;
+    for (const DeltaOp& op : ops) {
+        if (op.reuse) { reused += op.len; if (op.old_off != op.off) in_place_ok = false; }
+        else literal += op.len;
+    }
+    int src_fd = open_source(src);
+    if (src_fd < 0) return false;
+    bool ok = true;
+
+    if (in_place_ok) {
+        // every reused block is already where it belongs: write only the rest
+        int fd = ::open(dst.c_str(), O_WRONLY | O_CLOEXEC);
+        ok = fd >= 0;
+        for (const DeltaOp& op : ops) {
+            if (!ok) break;
+            if (!op.reuse) ok = kernel_copy_range(src_fd, op.off, fd, op.off, op.len);
+        }
+        if (ok) ok = ::ftruncate(fd, (off_t)in.size()) == 0;
+        if (ok && durability_per_file()) ok = ::fdatasync(fd) == 0;
+        drop_written_cache(fd);
+        if (fd >= 0) ::close(fd);
+        drop_read_cache(src_fd, 0, 0);
+        ::close(src_fd);
+        if (!ok) return false; // the destination may be half-patched; the full copy repairs it
+        note_dirty_dir(dst.parent_path());
+    } else {
+        int old_fd = ::open(dst.c_str(), O_RDONLY | O_CLOEXEC);
+        fs::path tmp = temp_path_for(dst);
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        ok = old_fd >= 0 && fd >= 0;
+        bool try_clone = true;
+        for (const DeltaOp& op : ops) {
+            if (!ok) break;
+            if (!op.reuse) { ok = kernel_copy_range(src_fd, op.off, fd, op.off, op.len); continue; }
+            // clone the block-aligned part of the run, copy whatever is left
+            uint64_t done = 0;
+            if (try_clone && op.old_off % 4096 == 0 && op.off % 4096 == 0) {
+                uint64_t n = (op.old_off + op.len == old.size()) ? op.len : op.len & ~(uint64_t)4095;
+                if (n > 0 && clone_range(old_fd, op.old_off, fd, op.off, n)) { done = n; cloned += n; }
+                else if (n > 0) try_clone = false;
+            }
+            if (done < op.len) ok = kernel_copy_range(old_fd, op.old_off + done, fd, op.off + done, op.len - done);
+        }
+        if (ok) ok = ::ftruncate(fd, (off_t)in.size()) == 0;
+        if (ok && durability_per_file()) ok = ::fdatasync(fd) == 0;
+        drop_written_cache(fd);
+        if (fd >= 0) ::close(fd);
+        if (old_fd >= 0) { drop_read_cache(old_fd, 0, 0); ::close(old_fd); }
+        drop_read_cache(src_fd, 0, 0);
+        ::close(src_fd);
+        std::error_code ec;
+        if (ok) {
+            fs::permissions(tmp, fs::status(src, ec).permissions(), ec);
+            ok = install_temp_file(tmp, dst, ec);
+        }
+        if (!ok) { fs::remove(tmp, ec); return false; }
+    }
+    g_delta_files++;
+    g_delta_literal_bytes += literal;
+    g_delta_reused_bytes += reused;
+    g_delta_cloned_bytes += cloned;
+    return true;
+}
+#endif
+
+static bool delta_applies(const fs::path& src, const fs::path& dst) {
+#ifdef _WIN32
+    (void)src; (void)dst;
+    return false;
+#else
+    if (!g_delta_enabled) return false;
+    std::error_code e1, e2;
+    uintmax_t ssz = fs::file_size(src, e1), dsz = fs::file_size(dst, e2);
+    return !e1 && !e2 && ssz >= g_delta_min_bytes && dsz >= g_delta_min_bytes / 2;
+#endif
+}
+
+// ========== Chunk reuse (FastCDC) ==========
+// Whole-file fingerprints only help when a new file is byte-identical to one
+// already in the destination. With --cdc, large destination files are also cut
+// into content-defined chunks (FastCDC: gear rolling hash with normalized
+// chunking, 16K min / 64K average / 256K max) and every chunk's XXH3-128 is
+// indexed. A new or changed source file is chunked the same way while it is
+// copied into a temp file, and every chunk the destination already holds is
+// cloned from there (FICLONERANGE) instead of written.
+//
+// Cloning needs both offsets to sit at the same place within a filesystem
+// block, so only those chunks (or their aligned middle) are taken from the
+// destination; every other byte is written from the source data that was just
+// read to chunk it. The index finds shared chunks after any insertion, but in
+// practice only appended data (a grown archive or log) and edits that move
+// data by whole blocks get cloned: an insertion of any other length shifts
+// everything after it off the block grid.
+//
+// Reused chunks are read back and checked against their hash first, so a
+// destination file that changed after indexing costs nothing but a fallback.
+// The index is built on the first file that needs it and only when the
+// destination filesystem supports reflinks; elsewhere there is nothing to
+// gain. POSIX only.
+static bool g_cdc_enabled = false;                     // --cdc
+static uint64_t g_cdc_min_bytes = 16ULL * 1024 * 1024; // --cdc-min
+static std::atomic<uint64_t> g_cdc_files{0}, g_cdc_matched_bytes{0}, g_cdc_cloned_bytes{0};
+
+static const size_t CDC_MIN_CHUNK = 16 * 1024;
+static const size_t CDC_AVG_BITS = 16; // 64 KiB
+static const size_t CDC_MAX_CHUNK = 256 * 1024;
+
+#ifndef _WIN32
+// Gear table from a fixed splitmix64 stream: boundaries must not change
+// between runs or builds.
+static const uint64_t* cdc_gear() {
+    static const std::vector<uint64_t> table = [] {
+        std::vector<uint64_t> t(256);
+        uint64_t x = 0x5EC0DEC0FFEE1234ULL;
+        for (auto& v : t) {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            v = z ^ (z >> 31);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+// Length of the chunk starting at p, given n bytes available (n is only below
+// CDC_MAX_CHUNK at the end of the file). The gear hash shifts one bit per byte,
+// so its top bits cover the last 64 bytes; before the average size a stricter
+// mask (2 more bits) is used and after it a looser one, which pulls chunk sizes
+// toward the average (FastCDC normalized chunking, level 2).
+static size_t cdc_cut(const uint8_t* p, size_t n) {
+    if (n <= CDC_MIN_CHUNK) return n;
+    static const uint64_t MASK_S = ~0ULL << (64 - (CDC_AVG_BITS + 2));
+    static const uint64_t MASK_L = ~0ULL << (64 - (CDC_AVG_BITS - 2));
+    const uint64_t* gear = cdc_gear();
+    size_t avg = std::min<size_t>(n, (size_t)1 << CDC_AVG_BITS);
+    size_t end = std::min(n, CDC_MAX_CHUNK);
+    uint64_t fp = 0;
+    size_t i = CDC_MIN_CHUNK;
+    for (; i < avg; ++i) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & MASK_S)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & MASK_L)) return i + 1;
+    }
+    return end;
+}
+
+// Calls fn(data, offset, length) for every chunk of the file in order.
+// False on a read error or when fn returns false.
+static bool cdc_for_each_chunk(FileReader& f, const std::function<bool(const uint8_t*, uint64_t, size_t)>& fn) {
+    const uint64_t size = f.size();
+    std::vector<uint8_t> buf(8u << 20);
+    uint64_t buf_off = 0;
+    size_t buf_len = 0, p = 0;
+    while (buf_off + p < size) {
+        if (buf_len - p < CDC_MAX_CHUNK && buf_off + buf_len < size) {
+            std::memmove(buf.data(), buf.data() + p, buf_len - p);
+            buf_off += p; buf_len -= p; p = 0;
+            long long r = f.pread_into(buf.data() + buf_len, buf.size() - buf_len, buf_off + buf_len);
+            if (r <= 0) return false;
+            buf_len += (size_t)r;
+            continue;
+        }
+        size_t n = cdc_cut(buf.data() + p, buf_len - p);
+        if (!fn(buf.data() + p, buf_off + p, n)) return false;
+        p += n;
+    }
+    return true;
+}
+
+struct StrongSumHash {
+    size_t operator()(const StrongSum& s) const { return (size_t)(s.lo ^ (s.hi * 0x9E3779B97F4A7C15ULL)); }
+};
+
+class ChunkIndex {
+public:
+    struct Loc {
+        uint32_t file;
+        uint32_t len;
+        uint64_t off;
+    };
+
+    // Destination files that may be indexed; nothing is read until ensure_built.
+    void set_candidates(std::vector<fs::path> files) {
+        std::lock_guard<std::mutex> lk(mtx);
+        candidates = std::move(files);
+        built = false;
+        map.clear();
+        paths.clear();
+    }
+
+    // Chunks every candidate once (in parallel). Returns false when the index
+    // is empty or the destination can't share extents.
+    bool ensure_built(bool verbose, bool colors) {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (built) return !map.empty();
+        built = true;
+        if (candidates.empty() || !reflinks_supported(candidates.front())) {
+            logMsg("[INFO] Chunk reuse skipped: the destination filesystem has no reflink support.", verbose, colors);
+            candidates.clear();
+            return false;
+        }
+        std::vector<std::vector<std::pair<StrongSum, Loc>>> per_file(candidates.size());
+        parallel_for_index(candidates.size(), g_max_concurrent_copies, [&](size_t i) {
+            FileReader f;
+            if (!f.open(candidates[i], ReadMode::Auto)) return;
+            auto& out = per_file[i];
+            bool ok = cdc_for_each_chunk(f, [&](const uint8_t* p, uint64_t off, size_t n) {
+                out.push_back({ strong_sum(p, n), Loc{ (uint32_t)i, (uint32_t)n, off } });
+                return true;
+            });
+            if (!ok) out.clear();
+        }, 1);
+        size_t total = 0;
+        for (const auto& v : per_file) total += v.size();
+        map.reserve(total);
+        for (const auto& v : per_file) for (const auto& e : v) map.emplace(e.first, e.second);
+        paths = std::move(candidates);
+        candidates.clear();
+        logMsg("[INFO] Destination chunk index ready (" + std::to_string(map.size()) + " chunks in " +
+               std::to_string(paths.size()) + " files).", verbose, colors);
+        return !map.empty();
+    }
+
+    // Read-only after ensure_built, so lookups need no lock.
+    const Loc* find(const StrongSum& s) const {
+        auto it = map.find(s);
+        return it == map.end() ? nullptr : &it->second;
+    }
+    const fs::path& path(uint32_t file) const { return paths[file]; }
+
+private:
+    // Tries to clone the first block of a destination file into a scratch file
+    // next to it.
+    static bool reflinks_supported(const fs::path& sample) {
+        fs::path probe = sample.parent_path() / (INTERNAL_FILE_PREFIX + "reflink-probe");
+        int in = ::open(sample.c_str(), O_RDONLY | O_CLOEXEC);
+        int out = ::open(probe.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool ok = in >= 0 && out >= 0 && clone_range(in, 0, out, 0, 4096);
+        if (in >= 0) ::close(in);
+        if (out >= 0) ::close(out);
+        std::error_code ec;
+        fs::remove(probe, ec);
+        return ok;
+    }
+
+    std::mutex mtx;
+    bool built = false;
+    std::vector<fs::path> candidates, paths;
+    std::unordered_map<StrongSum, Loc, StrongSumHash> map;
+};
+
+static ChunkIndex g_chunk_index;
+
+// Copies src to dst through a temp file, cloning every chunk the destination
+// already has. False when the index has nothing to offer or on an error; dst
+// is untouched then and the regular copy follows.
+static bool cdc_copy_file(const fs::path& src, const fs::path& dst, bool verbose, bool colors) {
+    if (!g_chunk_index.ensure_built(verbose, colors)) return false;
+    FileReader in;
+    if (!in.open(src, ReadMode::Auto)) return false;
+    fs::path tmp = temp_path_for(dst);
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return false;
+
+    std::unordered_map<uint32_t, int> old_fds;
+    std::vector<uint8_t> check(CDC_MAX_CHUNK);
+    uint64_t matched = 0, cloned = 0;
+    const uint64_t BLK = 4096;
+
+    // Clones the block-aligned middle of a matching chunk; the caller writes
+    // the rest from the source bytes.
+    auto clone_chunk = [&](const ChunkIndex::Loc& loc, const StrongSum& want, uint64_t off, size_t n,
+                           uint64_t& lo, uint64_t& hi) {
+        lo = (off + BLK - 1) & ~(BLK - 1);
+        hi = (off + n) & ~(BLK - 1);
+        if (loc.off % BLK != off % BLK || hi <= lo) return false;
+        auto it = old_fds.find(loc.file);
+        if (it == old_fds.end()) it = old_fds.emplace(loc.file, open_source(g_chunk_index.path(loc.file))).first;
+        int old_fd = it->second;
+        if (old_fd < 0) return false;
+        ssize_t r = ::pread(old_fd, check.data(), n, (off_t)loc.off);
+        if (r != (ssize_t)n || !(strong_sum(check.data(), n) == want)) return false;
+        return clone_range(old_fd, loc.off + (lo - off), fd, lo, hi - lo);
+    };
+
+    bool ok = cdc_for_each_chunk(in, [&](const uint8_t* p, uint64_t off, size_t n) {
+        StrongSum h = strong_sum(p, n);
+        const ChunkIndex::Loc* loc = g_chunk_index.find(h);
+        uint64_t lo = 0, hi = 0;
+        if (loc && loc->len == n && clone_chunk(*loc, h, off, n, lo, hi)) {
+            matched += n;
+            cloned += hi - lo;
+            return pwrite_all(fd, p, (size_t)(lo - off), off) &&
+                   pwrite_all(fd, p + (hi - off), (size_t)(off + n - hi), hi);
+        }
+        if (loc && loc->len == n) matched += n;
+        return pwrite_all(fd, p, n, off);
+    });
+    for (auto& e : old_fds) if (e.second >= 0) { drop_read_cache(e.second, 0, 0); ::close(e.second); }
+    if (ok) ok = ::ftruncate(fd, (off_t)in.size()) == 0;
+    if (ok && durability_per_file()) ok = ::fdatasync(fd) == 0;
+    drop_written_cache(fd);
+    ::close(fd);
+    std::error_code ec;
+    if (ok) {
+        fs::permissions(tmp, fs::status(src, ec).permissions(), ec);
+        ok = install_temp_file(tmp, dst, ec);
+    }
+    if (!ok) { fs::remove(tmp, ec); return false; }
+    g_cdc_files++;
+    g_cdc_matched_bytes += matched;
+    g_cdc_cloned_bytes += cloned;
+    return true;
+}
+#endif
+
+static bool cdc_applies(const fs::path& src) {
+#ifdef _WIN32
+    (void)src;
+    return false;
+#else
+    if (!g_cdc_enabled) return false;
+    std::error_code ec;
+    uintmax_t sz = fs::file_size(src, ec);
+    return !ec && sz >= g_cdc_min_bytes;
+#endif
+}
+
+// ========== Copy backends ==========
+// Whole-file copies pick the cheapest data path the two filesystems allow, in
+// order: FICLONE (reflink: extents are shared, nothing is written), then
+// copy_file_range (in-kernel, server-side on NFS/SMB), then sendfile, then a
+// pread/pwrite loop. The first backend that works for a source/destination
+// device pair is remembered, so later files start there instead of failing
+// through the faster ones again. Windows keeps fs::copy_file (CopyFileW).
+enum class CopyBackend { Clone, CopyFileRange, Sendfile, ReadWrite, Count };
+
+static const char* copy_backend_name(CopyBackend b) {
+    switch (b) {
+        case CopyBackend::Clone:         return "reflink";
+        case CopyBackend::CopyFileRange: return "copy_file_range";
+        case CopyBackend::Sendfile:      return "sendfile";
+        case CopyBackend::ReadWrite:     return "read/write";
+        default:                         return "?";
+    }
+}
+
+static const int COPY_BACKENDS = (int)CopyBackend::Count;
+
+// Files of at least --parallel-copy-min bytes that can't be cloned are copied
+// as PARALLEL_COPY_RANGE pieces by up to PARALLEL_COPY_MAX_THREADS threads
+// (capped by the copy concurrency), so one huge file keeps several I/Os in
+// flight on RAID and NVMe instead of a single stream.
+static uint64_t g_parallel_copy_min = 1ULL << 30; // --parallel-copy-min
+static const uint64_t PARALLEL_COPY_RANGE = 64ULL << 20;
+static const int PARALLEL_COPY_MAX_THREADS = 8;
+static std::atomic<uint64_t> g_backend_files[COPY_BACKENDS], g_backend_bytes[COPY_BACKENDS];
+static std::atomic<uint64_t> g_sparse_hole_bytes{0}; // holes left unwritten
+
+// Copies that aren't cloned reserve their blocks with fallocate(2) before the
+// first byte is written: the filesystem can then lay each file out in one
+// piece however many workers write at once, and a full destination fails the
+// copy up front with ENOSPC instead of halfway through a large file. Sparse
+// files only reserve their data extents. Small files are left to delayed
+// allocation. Linux only: posix_fallocate elsewhere may emulate by writing
+// zeros, and CopyFileW already preallocates on Windows.
+static bool g_preallocate = true; // --no-preallocate
+static const uint64_t PREALLOCATE_MIN = 1ULL << 20;
+static std::atomic<uint64_t> g_prealloc_files{0}, g_prealloc_bytes{0};
+
+// Resumable copies: a file of at least --resume-min bytes is copied into its
+// temp file as PARALLEL_COPY_RANGE pieces, and a journal next to it
+// (.synceverything-resume-<name>) records which pieces are on disk along with
+// the source's device, inode, size and mtime. Pieces are checkpointed (the
+// data fdatasync'ed, then the journal rewritten through a rename) every
+// RESUME_CHECKPOINT_BYTES or RESUME_CHECKPOINT_SECONDS. When a run is killed
+// or a copy fails, the temp file and journal stay behind, and the next run
+// copies only the missing pieces if the source is unchanged. Before trusting
+// the journal, the last 64 KiB of every recorded piece is compared with the
+// source. A failed check or a changed source starts the file over.
+class CopyJournal;
+
+// Hash-while-copy: a copy given a StreamDigest with a hasher feeds it every
+// byte of the file (holes as zeros) and sets fed_all. A clone moves no bytes,
+// so it leaves fed_all unset. Files that go through the parallel or resumable
+// paths keep their kernel-side copies and are not hashed; they get `deferred`.
+struct StreamDigest {
+    std::unique_ptr<Hasher> h;
+    bool fed_all = false;
+    bool deferred = false;
+};
+
+static bool g_resume_enabled = true;              // --no-resume
+static uint64_t g_resume_min = 1ULL << 30;        // --resume-min
+static const uint64_t RESUME_CHECKPOINT_BYTES = 1ULL << 30;
+static const int RESUME_CHECKPOINT_SECONDS = 10;
+static std::atomic<uint64_t> g_resumed_files{0}, g_resumed_bytes{0};
+
+static fs::path resume_journal_for(const fs::path& dst) {
+    return dst.parent_path() / (INTERNAL_FILE_PREFIX + "resume-" + dst.filename().string());
+}
+
+// Deletes the temp files (see temp_path_for) that a killed run left in `dir`,
+// keeping those a resume journal still refers to. syncDir calls it for each
+// destination directory before queueing any copy into it, so a temp file that
+// is being written is never touched.
+static void remove_stale_temp_files(const fs::path& dir, bool verbose, bool enableColors) {
+    const std::string tmp_prefix = INTERNAL_FILE_PREFIX + "tmp-";
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (name.rfind(tmp_prefix, 0) != 0) continue;
+        std::error_code fec;
+        if (fs::exists(resume_journal_for(dir / name.substr(tmp_prefix.size())), fec) || fec) continue;
+        if (fs::remove(it->path(), fec)) logMsg("Deleted stale temp file: " + it->path().string(), verbose, enableColors);
+    }
+}
+
+#ifndef _WIN32
+static std::mutex g_backend_mtx;
+static std::map<std::pair<dev_t, dev_t>, CopyBackend> g_backend_cache;
+
+// Errors that mean "not on this pair of filesystems" rather than an I/O error.
+static bool backend_unsupported(int err) {
+    return err == EXDEV || err == EOPNOTSUPP || err == ENOTSUP || err == EINVAL || err == ENOSYS || err == ENOTTY;
+}
+
+// Reserves `extents` in fd. Returns 0, or the errno when the destination is
+// out of space or quota; other failures (no fallocate support) are ignored.
+static int preallocate_extents(int fd, const std::vector<Extent>& extents) {
+#if defined(__linux__)
+    uint64_t total = 0;
+    for (const Extent& e : extents) {
+        int r;
+        do r = ::fallocate(fd, 0, (off_t)e.off, (off_t)e.len);
+        while (r != 0 && errno == EINTR);
+        if (r != 0) return (errno == ENOSPC || errno == EDQUOT) ? errno : 0;
+        total += e.len;
+    }
+    if (total > 0) {
+        g_prealloc_files++;
+        g_prealloc_bytes += total;
+    }
+#else
+    (void)fd;
+    (void)extents;
+#endif
+    return 0;
+}
+
+// Copies [off, end) with one backend and returns how far it got (Clone only
+// does whole files, from off 0). `unsupported` is set when it failed up front
+// for a reason that will repeat for every file on this device pair.
+static uint64_t run_copy_backend(CopyBackend b, int in, int out, uint64_t off, uint64_t end, bool& unsupported) {
+    unsupported = false;
+    const uint64_t start = off;
+    switch (b) {
+        case CopyBackend::Clone:
+#ifdef FICLONE
+            if (off == 0 && ::ioctl(out, FICLONE, in) == 0) return end;
+            unsupported = off == 0 && backend_unsupported(errno);
+#endif
+            return off;
+        case CopyBackend::CopyFileRange:
+#ifdef __linux__
+            while (off < end) {
+                loff_t io = (loff_t)off, oo = (loff_t)off;
+                size_t want = g_throttle.chunk((size_t)std::min<uint64_t>(end - off, 1ULL << 30));
+                g_throttle.acquire(want);
+                ssize_t r = ::copy_file_range(in, &io, out, &oo, want, 0);
+                if (r < 0 && errno == EINTR) continue;
+                if (r < 0) { unsupported = off == start && backend_unsupported(errno); break; }
+                if (r == 0) break;
+                off += (uint64_t)r;
+            }
+#endif
+            return off;
+        case CopyBackend::Sendfile:
+#ifdef __linux__
+            if (::lseek(out, (off_t)off, SEEK_SET) < 0) return off;
+            while (off < end) {
+                off_t io = (off_t)off;
+                size_t want = g_throttle.chunk((size_t)std::min<uint64_t>(end - off, 1ULL << 30));
+                g_throttle.acquire(want);
+                ssize_t r = ::sendfile(out, in, &io, want);
+                if (r < 0 && errno == EINTR) continue;
+                if (r < 0) { unsupported = off == start && backend_unsupported(errno); break; }
+                if (r == 0) break;
+                off += (uint64_t)r;
+            }
+#endif
+            return off;
+        default:
+            return rw_copy_range(in, off, out, off, end - off) ? end : off;
+    }
+}
+
+class CopyJournal {
+public:
+    CopyJournal(const fs::path& src, const fs::path& partial, const fs::path& journal)
+        : src(src), partial(partial), path(journal) {}
+
+    // Reads the journal left by an earlier run. Returns true (and remembers
+    // the recorded pieces) only if it matches the current source and the
+    // partial file agrees with the source at every recorded piece.
+    bool load(int in) {
+        std::error_code ec;
+        FileStamp now;
+        if (!file_stamp(src, now)) return false;
+        stamp = now;
+        std::ifstream f(path);
+        std::string magic, word;
+        int version = 0;
+        FileStamp old;
+        uint64_t range = 0;
+        if (!(f >> magic >> version) || magic != "synceverything-resume" || version != 1) return false;
+        if (!(f >> old.dev >> old.ino >> old.size >> old.mtime_ns)) return false;
+        if (old.dev != now.dev || old.ino != now.ino || old.size != now.size || old.mtime_ns != now.mtime_ns) return false;
+        if (!(f >> word >> range) || word != "range" || range != PARALLEL_COPY_RANGE) return false;
+        std::set<size_t> pieces;
+        std::string list;
+        if (!(f >> word) || word != "pieces" || !(f >> list)) return false;
+        if (list != "-") {
+            std::istringstream ls(list);
+            std::string item;
+            const size_t count = (size_t)((now.size + PARALLEL_COPY_RANGE - 1) / PARALLEL_COPY_RANGE);
+            try {
+                while (std::getline(ls, item, ',')) {
+                    size_t dash = item.find('-');
+                    size_t a = std::stoull(item.substr(0, dash));
+                    size_t b = dash == std::string::npos ? a : std::stoull(item.substr(dash + 1));
+                    if (a > b || b >= count) return false;
+                    for (size_t i = a; i <= b; ++i) pieces.insert(i);
+                }
+            } catch (...) {
+                return false;
+            }
+        }
+        if (!(f >> word) || word != "end") return false;
+        if (fs::file_size(partial, ec) != now.size || ec) return false;
+
+        int part = ::open(partial.c_str(), O_RDONLY | O_CLOEXEC);
+        if (part < 0) return false;
+        std::vector<uint8_t> a(64 * 1024), b(64 * 1024);
+        bool ok = true;
+        for (size_t i : pieces) {
+            uint64_t end = std::min(now.size, (uint64_t)(i + 1) * PARALLEL_COPY_RANGE);
+            uint64_t off = end - std::min<uint64_t>(a.size(), end - (uint64_t)i * PARALLEL_COPY_RANGE);
+            size_t n = (size_t)(end - off);
+            if (end <= (uint64_t)i * PARALLEL_COPY_RANGE || ::pread(in, a.data(), n, (off_t)off) != (ssize_t)n ||
+                ::pread(part, b.data(), n, (off_t)off) != (ssize_t)n || std::memcmp(a.data(), b.data(), n) != 0) {
+                ok = false;
+                break;
+            }
+        }
+        ::close(part);
+        if (!ok) return false;
+        done = std::move(pieces);
+        for (size_t i : done) resumed += std::min(now.size, (uint64_t)(i + 1) * PARALLEL_COPY_RANGE) - (uint64_t)i * PARALLEL_COPY_RANGE;
+        return true;
+    }
+
+    // Starts a fresh journal for the current source.
+    void reset() {
+        std::lock_guard<std::mutex> lk(m);
+        if (!file_stamp(src, stamp)) stamp = FileStamp();
+        done.clear();
+        resumed = 0;
+        last_save = std::chrono::steady_clock::now();
+    }
+
+    bool has(size_t piece) const { return done.count(piece) != 0; }
+    uint64_t resumed_bytes() const { return resumed; }
+    bool has_progress() const { return !done.empty(); }
+
+    // Records a piece whose data is written; checkpoints when enough has piled up.
+    void piece_done(size_t piece, uint64_t len, int out) {
+        std::lock_guard<std::mutex> lk(m);
+        pending.push_back(piece);
+        pending_bytes += len;
+        if (pending_bytes >= RESUME_CHECKPOINT_BYTES ||
+            std::chrono::steady_clock::now() - last_save >= std::chrono::seconds(RESUME_CHECKPOINT_SECONDS)) {
+            checkpoint(out);
+        }
+    }
+
+    // Checkpoints the pieces finished since the last checkpoint; called when
+    // the copy fails, so the journal covers everything that was written.
+    void flush(int out) {
+        std::lock_guard<std::mutex> lk(m);
+        if (!pending.empty()) checkpoint(out);
+    }
+
+    // Deletes the journal once the copy is installed (or abandoned).
+    void remove() {
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+
+private:
+    // Called with m held: the data goes to disk before the journal says so,
+    // and the pieces count as done only once the journal is in place.
+    void checkpoint(int out) {
+        last_save = std::chrono::steady_clock::now();
+        if (::fdatasync(out) != 0) return;
+        std::set<size_t> saved = done;
+        saved.insert(pending.begin(), pending.end());
+
+        std::string list;
+        for (auto it = saved.begin(); it != saved.end();) {
+            size_t a = *it, b = a;
+            while (++it != saved.end() && *it == b + 1) b = *it;
+            if (!list.empty()) list += ',';
+            list += std::to_string(a);
+            if (b != a) list += "-" + std::to_string(b);
+        }
+        std::ostringstream o;
+        o << "synceverything-resume 1\n"
+          << stamp.dev << ' ' << stamp.ino << ' ' << stamp.size << ' ' << stamp.mtime_ns << "\n"
+          << "range " << PARALLEL_COPY_RANGE << "\n"
+          << "pieces " << (list.empty() ? "-" : list) << "\n"
+          << "end\n";
+        const std::string text = o.str();
+        fs::path tmp = path;
+        tmp += ".new";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return;
+        bool ok = ::write(fd, text.data(), text.size()) == (ssize_t)text.size() && ::fdatasync(fd) == 0;
+        ::close(fd);
+        std::error_code ec;
+        if (ok) fs::rename(tmp, path, ec);
+        if (!ok || ec) { fs::remove(tmp, ec); return; }
+        done = std::move(saved);
+        pending.clear();
+        pending_bytes = 0;
+    }
+
+    fs::path src, partial, path;
+    FileStamp stamp;
+    std::mutex m;
+    std::set<size_t> done;
+    std::vector<size_t> pending;
+    uint64_t pending_bytes = 0, resumed = 0;
+    std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();
+};
+
+// Copies [0, size) as PARALLEL_COPY_RANGE pieces on several threads, each
+// piece with the first backend from `start` that works for it. Sendfile is
+// skipped because it writes at the shared file position. A backend found
+// unsupported is skipped by the remaining pieces and reported in `start`;
+// `main` receives the backend that moved most of the data. With a journal,
+// pieces it already has are skipped and finished ones are reported to it.
+// Returns false if a piece failed, with its errno in err.
+static bool parallel_copy_ranges(int in, int out, uint64_t size, bool sparse, CopyBackend& start, CopyBackend& main, int& err,
+                                 CopyJournal* journal = nullptr) {
+    size_t pieces = (size_t)((size + PARALLEL_COPY_RANGE - 1) / PARALLEL_COPY_RANGE);
+    int workers = std::min(g_max_concurrent_copies, PARALLEL_COPY_MAX_THREADS);
+    std::atomic<bool> failed{false};
+    std::atomic<int> first_err{0}, skip{(int)start};
+    std::atomic<uint64_t> moved[COPY_BACKENDS];
+    for (auto& m : moved) m = 0;
+    parallel_for_index(pieces, workers, [&](size_t i) {
+        if (failed || (journal && journal->has(i))) return;
+        const uint64_t piece_off = (uint64_t)i * PARALLEL_COPY_RANGE;
+        const uint64_t piece_end = std::min(size, piece_off + PARALLEL_COPY_RANGE);
+        std::vector<Extent> ext;
+        if (sparse) data_extents(in, piece_off, piece_end, ext);
+        else ext.push_back({ piece_off, piece_end - piece_off });
+        split_for_cache(ext);
+        CacheDropper cache(in, out);
+        for (const Extent& e : ext) {
+            uint64_t off = e.off;
+            const uint64_t end = e.off + e.len;
+            for (int b = skip; off < end && b < COPY_BACKENDS; ++b) {
+                if (b == (int)CopyBackend::Sendfile) continue;
+                bool unsupported = false;
+                errno = 0;
+                uint64_t done = run_copy_backend((CopyBackend)b, in, out, off, end, unsupported);
+                if (done > off) moved[b] += done - off;
+                if (unsupported) {
+                    int cur = skip;
+                    while (cur <= b && !skip.compare_exchange_weak(cur, b + 1)) {}
+                } else if (done < end && errno) {
+                    first_err = errno;
+                }
+                off = done;
+            }
+            if (off < end) { failed = true; return; }
+            cache.written(e.off, e.len);
+        }
+        if (journal) journal->piece_done(i, piece_end - piece_off, out);
+    }, 1);
+    int best = (int)CopyBackend::ReadWrite;
+    for (int b = 0; b < COPY_BACKENDS; ++b) {
+        g_backend_bytes[b] += moved[b];
+        if (moved[b] > moved[best]) best = b;
+    }
+    start = (CopyBackend)skip.load();
+    main = (CopyBackend)best;
+    err = first_err;
+    return !failed;
+}
+
+// One serial pass through user space that writes the data extents and feeds
+// every byte, holes as zeros, to `h`. Its bytes are reported apart from the
+// copy backends (see the "Hashed while copying" summary line).
+static bool hashing_copy(int in, int out, uint64_t size, bool sparse, Hasher& h, int& err) {
+    std::vector<uint8_t>& buf = hash_read_buffer();
+    auto feed_zeros = [&h](uint64_t n) {
+        while (n > 0) {
+            size_t k = (size_t)std::min<uint64_t>(n, HASH_READ_CHUNK);
+            h.update(zero_block(), k);
+            n -= k;
+        }
+    };
+    std::vector<Extent> ext;
+    if (sparse) data_extents(in, 0, size, ext);
+    else ext.push_back({ 0, size });
+    split_for_cache(ext);
+    CacheDropper cache(in, out);
+    uint64_t pos = 0;
+    for (const Extent& e : ext) {
+        feed_zeros(e.off - pos);
+        const uint64_t end = e.off + e.len;
+        for (uint64_t off = e.off; off < end;) {
+            size_t want = g_throttle.chunk((size_t)std::min<uint64_t>(end - off, buf.size()));
+            g_throttle.acquire(want);
+            ssize_t r = ::pread(in, buf.data(), want, (off_t)off);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) { err = r < 0 ? errno : EIO; return false; }
+            h.update(buf.data(), (size_t)r);
+            if (!pwrite_all(out, buf.data(), (size_t)r, off)) { err = errno; return false; }
+            off += (uint64_t)r;
+        }
+        cache.written(e.off, e.len);
+        pos = end;
+    }
+    feed_zeros(size - pos);
+    return true;
+}
+
+// Copies src over dst (created or truncated, with src's permission bits),
+// flushing the data to disk first when `sync_data` is set. With a journal the
+// copy goes piece by piece and continues a partial dst the journal vouches
+// for. With a StreamDigest the data is hashed on the way (see hashing_copy).
+// Throws fs::filesystem_error like fs::copy_file.
+static void copy_file_data(const fs::path& src, const fs::path& dst, bool sync_data = false, CopyJournal* journal = nullptr,
+                           StreamDigest* digest = nullptr) {
+    auto fail = [&](int err) {
+        throw fs::filesystem_error("cannot copy file", src, dst, std::error_code(err, std::generic_category()));
+    };
+    int in = open_source(src, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (in < 0) fail(errno);
+    struct stat sst, dstst;
+    if (::fstat(in, &sst) != 0) { int e = errno; ::close(in); fail(e); }
+    if (!S_ISREG(sst.st_mode)) { ::close(in); fail(EINVAL); }
+    const bool resuming = journal && journal->load(in);
+    if (journal && !resuming) journal->reset();
+    Hasher* hasher = digest ? digest->h.get() : nullptr;
+    int out = ::open(dst.c_str(), (hasher ? O_RDWR : O_WRONLY) | O_CREAT | (resuming ? 0 : O_TRUNC) | O_CLOEXEC, 0600);
+    if (out < 0) { int e = errno; ::close(in); fail(e); }
+    if (::fstat(out, &dstst) != 0) dstst.st_dev = 0;
+
+    const uint64_t size = (uint64_t)sst.st_size;
+    const auto key = std::make_pair(sst.st_dev, dstst.st_dev);
+    CopyBackend first = CopyBackend::Clone;
+    {
+        std::lock_guard<std::mutex> lk(g_backend_mtx);
+        auto it = g_backend_cache.find(key);
+        if (it != g_backend_cache.end()) first = it->second;
+    }
+    int last = -1, err = 0;
+    bool done = size == 0;
+    if (done && hasher) digest->fed_all = true;
+    int b = (int)first;
+    auto demote = [&](int to) {
+        std::lock_guard<std::mutex> lk(g_backend_mtx);
+        CopyBackend& cached = g_backend_cache.emplace(key, first).first->second;
+        if ((int)cached < to) cached = (CopyBackend)to;
+    };
+    if (!done && b == (int)CopyBackend::Clone) {
+        // a reflink copies everything, holes included, or nothing
+        bool unsupported = false;
+        errno = 0;
+        if (run_copy_backend(CopyBackend::Clone, in, out, 0, size, unsupported) == size) {
+            g_backend_bytes[b] += size;
+            last = b;
+            done = true;
+        } else {
+            err = errno;
+            if (unsupported) demote(b + 1);
+        }
+        ++b;
+    }
+    if (!done) {
+        // only the data extents are copied; holes stay holes in the new file
+        const bool sparse = stat_is_sparse(sst);
+        std::vector<Extent> extents;
+        uint64_t data = size;
+        if (sparse) {
+            data_extents(in, 0, size, extents);
+            data = 0;
+            for (const Extent& e : extents) data += e.len;
+        }
+        if (sparse || journal || size >= g_parallel_copy_min) {
+            if (::ftruncate(out, (off_t)size) != 0) { err = errno; b = COPY_BACKENDS; }
+        }
+        if (b < COPY_BACKENDS && g_preallocate && data >= PREALLOCATE_MIN) {
+            int e = preallocate_extents(out, sparse ? extents : std::vector<Extent>{ { 0, size } });
+            if (e != 0) { err = e; b = COPY_BACKENDS; }
+        }
+        // Hashing needs the bytes in user space. That costs little next to a
+        // serial copy, but would cost big files their parallel kernel-side
+        // ranges, so those are left for the next run to hash.
+        const bool big = journal || size >= g_parallel_copy_min;
+        if (hasher && big) digest->deferred = true;
+        if (b < COPY_BACKENDS && hasher && !big) {
+            if (hashing_copy(in, out, size, sparse, *hasher, err)) {
+                done = true;
+                digest->fed_all = true;
+            }
+        } else if (b < COPY_BACKENDS && (journal || (size >= g_parallel_copy_min && g_max_concurrent_copies > 1))) {
+            // no reflink: copy the big file as concurrent ranges
+            CopyBackend from = (CopyBackend)b, main = from;
+            if (parallel_copy_ranges(in, out, size, sparse, from, main, err, journal)) {
+                last = (int)main;
+                done = true;
+            }
+            if ((int)from > b) demote((int)from);
+        } else if (b < COPY_BACKENDS) {
+            if (!sparse) extents.push_back({ 0, size });
+            split_for_cache(extents);
+            CacheDropper cache(in, out);
+            done = true;
+            for (const Extent& e : extents) {
+                uint64_t off = e.off;
+                const uint64_t end = e.off + e.len;
+                while (off < end && b < COPY_BACKENDS) {
+                    bool unsupported = false;
+                    errno = 0;
+                    uint64_t got = run_copy_backend((CopyBackend)b, in, out, off, end, unsupported);
+                    if (got > off) {
+                        g_backend_bytes[b] += got - off;
+                        last = b;
+                    }
+                    off = got;
+                    if (off < end) {
+                        err = errno;
+                        if (unsupported) demote(b + 1);
+                        ++b;
+                    }
+                }
+                if (off < end) { done = false; break; }
+                cache.written(e.off, e.len);
+            }
+        }
+        if (done) g_sparse_hole_bytes += size - data;
+    }
+    if (done && last >= 0) g_backend_files[last]++;
+    bool ok = done && ::fchmod(out, sst.st_mode & 07777) == 0 && (!sync_data || ::fdatasync(out) == 0);
+    if (!ok && done) err = errno;
+    if (!ok && journal) journal->flush(out);
+    drop_read_cache(in, 0, 0); // readahead may have crossed into pieces other threads already dropped
+    ::close(in);
+    if (::close(out) != 0 && ok) { ok = false; err = errno; }
+    if (!ok) fail(err ? err : EIO);
+}
+#else
+static void copy_file_data(const fs::path& src, const fs::path& dst, bool sync_data = false, CopyJournal* journal = nullptr,
+                           StreamDigest* digest = nullptr) {
+    (void)journal; // no resumable copies on Windows
+    Hasher* hasher = digest ? digest->h.get() : nullptr;
+    if (g_throttle.active() || hasher) {
+        // CopyFileW can't be paced or hashed: stream through the reader
+        FileReader in;
+        std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+        bool ok = in.open(src, ReadMode::Pread) && out &&
+                  in.read_range(0, in.size(), [&](const uint8_t* p, size_t n) {
+                      if (hasher) hasher->update(p, n);
+                      out.write((const char*)p, (std::streamsize)n);
+                  });
+        out.close();
+        if (ok && hasher) digest->fed_all = true;
+        std::error_code ec;
+        if (!ok || !out) throw fs::filesystem_error("cannot copy file", src, dst, std::make_error_code(std::errc::io_error));
+        fs::permissions(dst, fs::status(src, ec).permissions(), ec);
+    } else {
+        fs::copy_file(src, dst, fs::copy_options::overwrite_existing);
+    }
+    if (sync_data && !flush_file(dst))
+        throw fs::filesystem_error("cannot flush file", dst, std::error_code((int)GetLastError(), std::system_category()));
+}
+#endif
+
+// One summary line: which backend moved how many files and bytes.
+static std::string copy_backend_summary() {
+    std::string s;
+    for (int b = 0; b < COPY_BACKENDS; ++b) {
+        if (g_backend_files[b] == 0 && g_backend_bytes[b] == 0) continue;
+        if (!s.empty()) s += ", ";
+        s += std::string(copy_backend_name((CopyBackend)b)) + " " + std::to_string(g_backend_files[b].load()) +
+             " file(s) / " + format_bytes(g_backend_bytes[b]);
+    }
+    if (g_sparse_hole_bytes > 0) s += "; " + format_bytes(g_sparse_hole_bytes) + " of holes skipped";
+    return s;
+}
+
+// ========== Adaptive concurrency ==========
+// The copy pool starts with the static budget of the speed mode and is then
+// resized by an AIMD controller from what the copies achieve. Every half
+// second it compares the bytes/s and per-copy latency of the last window with
+// the one before: while the queues have a backlog it adds one worker per
+// device, and when throughput drops (or latency balloons without a throughput
+// gain) it cuts the budget by a quarter. The budget applies to every device
+// alike; the measurement is the run's total. A flat result holds the budget for a few windows before
+// probing again. HDDs settle low, where extra seeks cost throughput; NVMe and
+// arrays climb until they stop scaling. --fixed-concurrency turns it off.
+static bool g_fixed_concurrency = false; // --fixed-concurrency
+
+// Completed copies, fed by copy_one_file and the small-file batches.
+struct CopyMeter {
+    std::atomic<uint64_t> bytes{0}, ops{0}, busy_ns{0};
+
+    void record(uint64_t n, std::chrono::steady_clock::time_point started) {
+        bytes += n;
+        ops++;
+        busy_ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+    }
+};
 
-// Default policy:
-// - by default (no --sha256-min and no --sha256-max specified) we treat min/max as NOT set,
-//   which means: if --sha256 is provided, SHA applies to ALL files.
-// - if user supplies --sha256-min or --sha256-max, the corresponding bound will be enforced.
+static CopyMeter g_copy_meter;
 
-// value holders
-static uint64_t g_sha256_min_bytes = 0ULL;                 // default 0 = no lower bound
-static uint64_t g_sha256_max_bytes = UINT64_MAX;          // default UINT64_MAX = no upper bound
+class ConcurrencyController {
+public:
+    ~ConcurrencyController() { stop(); }
 
-// flags to indicate whether the user explicitly provided those bounds
-static bool g_sha256_min_set = false;
-static bool g_sha256_max_set = false;
+    void start(int initial, int lo_, int hi_, bool verbose_, bool colors_) {
+        lo = lo_;
+        hi = hi_;
+        cur = initial;
+        verbose = verbose_;
+        colors = colors_;
+        t0 = clock::now();
+        timeline.push_back({0.0, cur, 0.0});
+        worker = std::thread([this] { run(); });
+    }
 
-static std::string bytes_to_hex(const uint8_t* data, size_t len) {
-    std::ostringstream oss;
-    oss << std::hex << std::setfill('0');
-    for (size_t i = 0; i < len; ++i) oss << std::setw(2) << static_cast<unsigned int>(data[i]);
-    return oss.str();
-}
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) worker.join();
+    }
 
-#ifdef _WIN32
-static std::string compute_file_sha256_hex(const fs::path& path) {
-    constexpr LPCWSTR ALG = BCRYPT_SHA256_ALGORITHM;
-    BCRYPT_ALG_HANDLE hAlg = NULL;
-    BCRYPT_HASH_HANDLE hHash = NULL;
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return std::string();
+    // "Copy concurrency" summary line, or "" when the controller never ran.
+    std::string summary() const {
+        if (timeline.empty()) return "";
+        int lo_seen = cur, hi_seen = cur;
+        for (const Step& st : timeline) {
+            lo_seen = std::min(lo_seen, st.conc);
+            hi_seen = std::max(hi_seen, st.conc);
+        }
+        std::string s = "Copy concurrency: " + std::to_string(timeline.front().conc) + " -> " + std::to_string(cur) +
+                        " (range " + std::to_string(lo_seen) + "-" + std::to_string(hi_seen) + ", " +
+                        std::to_string(timeline.size() - 1) + " change(s))";
+        if (timeline.size() < 2) return s + ".";
+        s += "; timeline:";
+        const size_t keep = 6;
+        for (size_t i = 0; i < timeline.size(); ++i) {
+            if (timeline.size() > 2 * keep && i == keep) {
+                s += " ...";
+                i = timeline.size() - keep;
+            }
+            const Step& st = timeline[i];
+            std::ostringstream o;
+            o << std::fixed << std::setprecision(1) << st.t << "s=" << st.conc;
+            if (st.rate > 0) o << " @" << format_bytes((uint64_t)st.rate) << "/s";
+            s += (i ? ", " : " ") + o.str();
+        }
+        return s + ".";
+    }
 
-    NTSTATUS status = BCryptOpenAlgorithmProvider(&hAlg, ALG, NULL, 0);
-    if (!BCRYPT_SUCCESS(status) || hAlg == NULL) return std::string();
+private:
+    using clock = std::chrono::steady_clock;
+    static constexpr int WINDOW_MS = 500;
+    static constexpr int HOLD_WINDOWS = 4;
+    struct Step {
+        double t;
+        int conc;
+        double rate;
+    };
 
-    DWORD cbHashObject = 0, cbData = 0;
-    status = BCryptGetProperty(hAlg, BCRYPT_OBJECT_LENGTH, (PUCHAR)&cbHashObject, sizeof(cbHashObject), &cbData, 0);
-    if (!BCRYPT_SUCCESS(status)) { BCryptCloseAlgorithmProvider(hAlg,0); return std::string(); }
+    void run() {
+        uint64_t b0 = g_copy_meter.bytes, o0 = g_copy_meter.ops, n0 = g_copy_meter.busy_ns;
+        clock::time_point w0 = clock::now();
+        double prev_rate = 0, prev_lat = 0;
+        int hold = 0;
+        std::unique_lock<std::mutex> lk(m);
+        while (!cv.wait_for(lk, std::chrono::milliseconds(WINDOW_MS), [&] { return stopping; })) {
+            size_t queued = 0, busy = 0;
+            g_copy_pool.load(queued, busy);
+            clock::time_point now = clock::now();
+            uint64_t b = g_copy_meter.bytes, o = g_copy_meter.ops, n = g_copy_meter.busy_ns;
+            if (queued == 0 && busy == 0) {
+                // idle (e.g. between directories): a window spanning it says nothing
+                b0 = b, o0 = o, n0 = n, w0 = now;
+                prev_rate = prev_lat = 0;
+                continue;
+            }
+            double dt = std::chrono::duration<double>(now - w0).count();
+            if (o - o0 < 4 && dt < 2.0) continue; // too few completions to judge yet
+            double rate = (double)(b - b0) / dt;
+            double lat = o > o0 ? (double)(n - n0) / (double)(o - o0) : dt * 1e9;
+            b0 = b, o0 = o, n0 = n, w0 = now;
 
-    std::vector<uint8_t> hashObject(cbHashObject);
-    status = BCryptCreateHash(hAlg, &hHash, hashObject.data(), (ULONG)hashObject.size(), NULL, 0, 0);
-    if (!BCRYPT_SUCCESS(status) || hHash == NULL) { BCryptCloseAlgorithmProvider(hAlg,0); return std::string(); }
+            int next = cur;
+            if (prev_rate > 0 && (rate < prev_rate * 0.8 || (lat > prev_lat * 2 && rate < prev_rate * 1.1))) {
+                next = std::max(lo, cur - std::max(1, cur / 4));
+                hold = HOLD_WINDOWS;
+            } else if (prev_rate > 0 && rate < prev_rate * 1.05 && hold > 0) {
+                --hold;
+            } else if (queued > 0 && cur < hi) {
+                next = cur + 1;
+                if (prev_rate > 0 && rate < prev_rate * 1.05) hold = HOLD_WINDOWS;
+            }
+            prev_rate = rate;
+            prev_lat = lat;
+            if (next == cur) continue;
 
-    const size_t CHUNK = 1 << 16; // 64KB
-    std::vector<uint8_t> buf(CHUNK);
-    while (in.good()) {
-        in.read(reinterpret_cast<char*>(buf.data()), (std::streamsize)buf.size());
-        std::streamsize r = in.gcount();
-        if (r > 0) {
-            status = BCryptHashData(hHash, buf.data(), (ULONG)r, 0);
-            if (!BCRYPT_SUCCESS(status)) { BCryptDestroyHash(hHash); BCryptCloseAlgorithmProvider(hAlg,0); return std::string(); }
+            if (verbose) {
+                std::ostringstream o;
+                o << "[INFO] Copy concurrency " << cur << " -> " << next << " (" << format_bytes((uint64_t)rate) << "/s, "
+                  << std::fixed << std::setprecision(1) << lat / 1e6 << " ms per copy)";
+                logMsg(o.str(), true, colors);
+            }
+            cur = next;
+            g_copy_pool.set_limit(cur);
+            if (timeline.size() < MAX_STEPS)
+                timeline.push_back({std::chrono::duration<double>(now - t0).count(), cur, rate});
         }
     }
 
-    DWORD cbHash = 0;
-    status = BCryptGetProperty(hAlg, BCRYPT_HASH_LENGTH, (PUCHAR)&cbHash, sizeof(cbHash), &cbData, 0);
-    if (!BCRYPT_SUCCESS(status)) { BCryptDestroyHash(hHash); BCryptCloseAlgorithmProvider(hAlg,0); return std::string(); }
+    static constexpr size_t MAX_STEPS = 4096;
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread worker;
+    std::vector<Step> timeline;
+    clock::time_point t0;
+    int lo = 1, hi = 1, cur = 1;
+    bool verbose = false, colors = false, stopping = false;
+};
 
-    std::vector<uint8_t> hashBuf(cbHash);
-    status = BCryptFinishHash(hHash, hashBuf.data(), (ULONG)hashBuf.size(), 0);
+static ConcurrencyController g_concurrency;
 
-    BCryptDestroyHash(hHash);
-    BCryptCloseAlgorithmProvider(hAlg, 0);
+// ========== Copy helper ==========
 
-    if (!BCRYPT_SUCCESS(status)) return std::string();
-    return bytes_to_hex(hashBuf.data(), hashBuf.size());
-}
-#endif
-
-static std::string compute_file_fnv_hex(const fs::path& path) {
-    const size_t CHUNK = 128 * 1024;
-    std::ifstream f(path, std::ios::binary);
-    if (!f) return std::string();
-    f.seekg(0, std::ios::end);
-    std::streamoff size = f.tellg();
-    f.seekg(0, std::ios::beg);
-    std::vector<uint8_t> buf;
-    auto fnv64 = [](const uint8_t* data, size_t len)->uint64_t {
-        const uint64_t FNV_OFFSET = 1469598103934665603ull;
-        const uint64_t FNV_PRIME  = 1099511628211ull;
-        uint64_t h = FNV_OFFSET;
-        for (size_t i = 0; i < len; ++i) { h ^= data[i]; h *= FNV_PRIME; }
-        return h;
-    };
+static std::atomic<size_t> g_copy_failures{0};
+static std::atomic<uint64_t> g_copy_hashed_files{0}, g_copy_hashed_bytes{0};
+static std::atomic<uint64_t> g_copy_unhashed_files{0}, g_copy_unhashed_bytes{0};
 
-    if (size <= (std::streamoff)(2 * CHUNK)) {
-        if (size == 0) return std::string();
-        buf.resize((size_t)size);
-        f.read(reinterpret_cast<char*>(buf.data()), size);
-        uint64_t h = fnv64(buf.data(), buf.size());
-        std::ostringstream oss; oss << std::hex << std::setfill('0') << std::setw(16) << h;
-        return oss.str();
-    } else {
-        buf.resize(2 * CHUNK);
-        f.read(reinterpret_cast<char*>(buf.data()), CHUNK);
-        f.seekg(size - CHUNK, std::ios::beg);
-        f.read(reinterpret_cast<char*>(buf.data()+CHUNK), CHUNK);
-        uint64_t h = fnv64(buf.data(), buf.size());
-        std::ostringstream oss; oss << std::hex << std::setfill('0') << std::setw(16) << h;
-        return oss.str();
+// Hash-while-copy. A copied file holds what its source held, so with the
+// fingerprint cache on, what the scan learned about the source is stored for
+// the new destination file as well. The next run then finds both in the cache
+// instead of reading them again. When a full-content --hash applies and the
+// source's full digest isn't known yet, the copy computes it from the bytes it
+// streams (see hashing_copy) and stores it for both files, unless the file is
+// big enough for a parallel or resumable copy (see copy_file_data). A sampled
+// fingerprint the scan didn't compute is taken from the fresh copy while it is
+// still in the page cache. Files whose sampled fingerprint already covers
+// every byte never need the full digest.
+// If the source changes during the copy, only the streamed digest, which
+// describes exactly what was written, is kept.
+class CopyFingerprints {
+public:
+    CopyFingerprints(const fs::path& src, uint64_t size) {
+        if (!g_fp_cache.enabled() || !file_stamp(src, before)) return;
+        stamped = true;
+        bool complete = false;
+        have_sampled = g_fp_cache.lookup(before, HashAlgo::Sampled, sampled.digest, sampled.complete, false);
+        if (g_hash_algo == HashAlgo::Sampled || !full_hash_applies_to_size(size)) return;
+        if (have_sampled && sampled.complete) return;
+        if (g_fp_cache.lookup(before, g_hash_algo, full, complete, false)) return;
+        stream.h = make_hasher(g_hash_algo);
     }
-}
 
-static std::string file_fingerprint_hex(const fs::path& p) {
-    std::error_code ec;
-    uintmax_t fsize = 0;
-    try {
-        fsize = fs::file_size(p, ec);
-    } catch (...) {
-        ec = std::make_error_code(std::errc::io_error);
+    // Handed to copy_file_data; nullptr when there is nothing to compute.
+    StreamDigest* digest() { return stream.h ? &stream : nullptr; }
+
+    // Called once dst is in place.
+    void finish(const fs::path& src, const fs::path& dst, uint64_t size, bool verbose, bool colors) {
+        if (!stamped) return;
+        FileStamp after, out;
+        bool unchanged = file_stamp(src, after) && after.size == before.size &&
+                         after.mtime_ns == before.mtime_ns && after.ctime_ns == before.ctime_ns;
+        if (!file_stamp(dst, out)) return;
+        Digest streamed;
+        if (stream.h && stream.fed_all) {
+            streamed = stream.h->finish();
+            g_copy_hashed_files++;
+            g_copy_hashed_bytes += size;
+            if (unchanged) g_fp_cache.store(after, streamed, true);
+            if (verbose) logMsg("[INFO] Hashed while copying: " + fingerprint_to_string(streamed) + " " + dst.string(), true, colors);
+        } else if (stream.deferred) {
+            g_copy_unhashed_files++;
+            g_copy_unhashed_bytes += size;
+        }
+        if (!streamed.empty()) g_fp_cache.store(out, streamed, true);
+        if (!unchanged) return;
+        if (!have_sampled && !g_no_cache_pollution) {
+            // the samples come out of the page cache the copy just filled
+            sampled = compute_file_sampled(dst);
+            have_sampled = !sampled.digest.empty();
+            if (have_sampled) g_fp_cache.store(after, sampled.digest, sampled.complete);
+        }
+        if (have_sampled) g_fp_cache.store(out, sampled.digest, sampled.complete);
+        if (!full.empty()) g_fp_cache.store(out, full, true);
     }
 
-    if (!ec && g_use_sha256) {
-        uint64_t sz = static_cast<uint64_t>(fsize);
+private:
+    FileStamp before;
+    bool stamped = false, have_sampled = false;
+    SampledFingerprint sampled;
+    Digest full;
+    StreamDigest stream;
+};
 
-        // Enforce bounds only if they were explicitly set by the user.
-        // If neither bound is set (both flags false) -> allow SHA for all files.
-        if ( (g_sha256_min_set && sz < g_sha256_min_bytes) ) {
-            // smaller than requested minimum -> skip SHA -> use FNV
-        } else if ( (g_sha256_max_set && sz > g_sha256_max_bytes) ) {
-            // larger than requested maximum -> skip SHA -> use FNV
-        } else {
-            // either no bounds set, or sz is within the explicitly-set bounds -> try SHA
-#ifdef _WIN32
-            std::string hex = compute_file_sha256_hex(p);
-            if (!hex.empty()) return hex;
+// Copies one file the best way available (delta, chunk reuse, or a full copy
+// through a temp file) and logs the result. Failures are logged and counted,
+// then rethrown.
+static void copy_one_file(const fs::path& src, const fs::path& dst, bool verbose, bool enableColors) {
+    const auto started = std::chrono::steady_clock::now();
+    std::error_code size_ec;
+    const uint64_t size = fs::file_size(src, size_ec);
+    try {
+        CopyFingerprints fps(src, size_ec ? 0 : size);
+#ifndef _WIN32
+        if (fs::exists(dst) && delta_applies(src, dst) && delta_copy_file(src, dst)) {
+            fps.finish(src, dst, size, verbose, enableColors);
+            logMsg("Updated (delta) " + src.string() + " -> " + dst.string(), true, enableColors);
+            g_copy_meter.record(size_ec ? 0 : size, started);
+            return;
+        }
+        if (cdc_applies(src) && cdc_copy_file(src, dst, verbose, enableColors)) {
+            fps.finish(src, dst, size, verbose, enableColors);
+            logMsg("Copied (chunk reuse) " + src.string() + " -> " + dst.string(), true, enableColors);
+            g_copy_meter.record(size_ec ? 0 : size, started);
+            return;
+        }
+#endif
+        fs::path tmp = temp_path_for(dst);
+        std::error_code ec;
+        CopyJournal* journal = nullptr;
+#ifndef _WIN32
+        std::unique_ptr<CopyJournal> resume;
+        if (g_resume_enabled && !size_ec && size >= g_resume_min) {
+            resume.reset(new CopyJournal(src, tmp, resume_journal_for(dst)));
+            journal = resume.get();
+        }
 #endif
-            // if SHA failed for any reason, fall through to FNV
+        try {
+            copy_file_data(src, tmp, durability_per_file(), journal, fps.digest());
+        } catch (...) {
+#ifndef _WIN32
+            if (journal && journal->has_progress()) throw; // the next run picks it up
+            if (journal) journal->remove();
+#endif
+            fs::remove(tmp, ec);
+            throw;
+        }
+        if (!install_temp_file(tmp, dst, ec)) {
+            std::error_code ec2;
+            fs::remove(tmp, ec2);
+            throw fs::filesystem_error("cannot replace file", tmp, dst, ec);
         }
+        fps.finish(src, dst, size, verbose, enableColors);
+#ifndef _WIN32
+        if (journal) {
+            journal->remove();
+            if (journal->resumed_bytes() > 0) {
+                g_resumed_files++;
+                g_resumed_bytes += journal->resumed_bytes();
+                logMsg("Copied (resumed, " + format_bytes(journal->resumed_bytes()) + " already there) " + src.string() + " -> " + dst.string(), true, enableColors);
+                g_copy_meter.record(size - journal->resumed_bytes(), started);
+                return;
+            }
+        }
+#endif
+        logMsg("Copied " + src.string() + " -> " + dst.string(), true, enableColors);
+        g_copy_meter.record(size_ec ? 0 : size, started);
+    } catch (const std::exception& ex) {
+        g_copy_failures++;
+        logMsg(std::string("[X] ERROR copying file: ") + ex.what() + " [" + src.string() + "] [" + dst.string() + "]", true, enableColors);
+        throw;
     }
-    // fallback (or sha disabled / out-of-range)
-    return compute_file_fnv_hex(p);
 }
 
-
-// ========== Logging ==========
-std::mutex logMutex;
-std::ofstream logFile;
-
-void logMsg(const std::string& msg, bool verbose, bool useColor) {
-    { 
-        std::lock_guard<std::mutex> lock(logMutex);
-        if (logFile.is_open()) {
-            auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-            logFile << "[" << std::ctime(&now);
-            logFile.seekp(-1, std::ios::cur);
-            logFile << "] " << msg << "\n";
+// Device ID of the filesystem holding `dir` (or its nearest existing
+// ancestor), used to give each device pair its own copy queue. Remembered per
+// directory, since the scan asks for the same few directories over and over.
+// 0 on Windows, where all copies share one queue.
+static uint64_t device_of_dir(const fs::path& dir) {
+#ifdef _WIN32
+    (void)dir;
+    return 0;
+#else
+    static std::mutex mu;
+    static std::unordered_map<std::string, uint64_t> cache;
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = cache.find(dir.native());
+    if (it != cache.end()) return it->second;
+    uint64_t dev = 0;
+    struct stat st;
+    for (fs::path p = dir; !p.empty(); p = p.parent_path()) {
+        if (::stat(p.c_str(), &st) == 0) {
+            dev = (uint64_t)st.st_dev;
+            break;
         }
+        if (p == p.parent_path()) break;
     }
+    cache.emplace(dir.native(), dev);
+    return dev;
+#endif
+}
 
-    if (verbose) {
-        if (useColor) {
-            std::string final_msg = msg;
-            if (msg.find("[DRY-RUN]") != std::string::npos || msg.find("INFO:") != std::string::npos || msg.find("Would MOVE") != std::string::npos) {
-                final_msg = BOLD_YELLOW + msg + RESET;
-            } 
-            else if (msg.find("SUCCESS!") != std::string::npos || msg.find("Copied") != std::string::npos || msg.find("All Tasks Finished !!") != std::string::npos || msg.find("Renamed") != std::string::npos || msg.find("Deleted:") != std::string::npos) {
-                final_msg = BOLD_GREEN + msg + RESET;
-            }
-            else if (msg.find("[X] ERROR:") != std::string::npos) {
-                final_msg = BOLD_RED + msg + RESET;
-            }
-            else if (msg.find("Ignored:") != std::string::npos) {
-                final_msg = BLUE + msg + RESET;
-            }
-            std::cout << final_msg << std::endl;
+// Queues the copy on the worker pool (blocking while its device pair's queue
+// is full) and returns; results are logged by the worker as each copy finishes.
+void copyFileAsync(const fs::path& src, const fs::path& dst, bool dryRun, bool verbose, bool enableColors) {
+    if (dryRun) {
+        if (fs::exists(dst) && delta_applies(src, dst)) {
+            logMsg("[DRY-RUN] Would UPDATE (delta) " + src.string() + " -> " + dst.string(), true, enableColors);
+        } else if (fs::exists(dst)) {
+            logMsg("[DRY-RUN] Would REPLACE " + src.string() + " -> " + dst.string(), true, enableColors);
         } else {
-            std::cout << msg << std::endl;
+            logMsg("[DRY-RUN] Would copy " + src.string() + " -> " + dst.string(), true, enableColors);
         }
+        return;
     }
-}
 
-// ========== Settings helper ==========
-const std::string SETTINGS_FILE = "settings.json";
-void saveSettings(const std::map<std::string, std::string>& settings) {
-    std::ofstream out(SETTINGS_FILE);
-    out << "{\n";
-    for (auto it = settings.begin(); it != settings.end(); ++it) {
-        out << "  \"" << it->first << "\": \"" << it->second << "\"";
-        if (std::next(it) != settings.end()) out << ",";
-        out << "\n";
+    if (!fs::exists(dst.parent_path())) {
+        fs::create_directories(dst.parent_path());
     }
-    out << "}\n";
+
+    g_copy_pool.submit([=]() { copy_one_file(src, dst, verbose, enableColors); },
+                       device_of_dir(src.parent_path()), device_of_dir(dst.parent_path()));
 }
-std::map<std::string, std::string> loadSettings() {
-    std::map<std::string, std::string> settings;
-    std::ifstream in(SETTINGS_FILE);
-    if (!in.is_open()) return settings;
-    std::string line;
-    while (std::getline(in, line)) {
-        auto keyStart = line.find("\"");
-        auto keyEnd = line.find("\"", keyStart + 1);
-        if (keyStart == std::string::npos || keyEnd == std::string::npos) continue;
-        std::string key = line.substr(keyStart + 1, keyEnd - keyStart - 1);
-        auto valStart = line.find("\"", keyEnd + 1);
-        auto valEnd = line.find("\"", valStart + 1);
-        if (valStart == std::string::npos || valEnd == std::string::npos) continue;
-        std::string val = line.substr(valStart + 1, valEnd - valStart - 1);
-        settings[key] = val;
+
+// ========== Small-file batches ==========
+// Below SMALL_FILE_MAX the fixed cost of a file (queue hand-off, path lookups,
+// a log line) outweighs copying its bytes. The scanner therefore groups the
+// small files of one directory into batches that a single worker copies back
+// to back: both directories are opened once and each file is opened relative
+// to them, its data goes through the worker's reused buffer with one read and
+// one write, and the batch is logged as one message. With --durability=file
+// the directory is fsynced once per batch instead of once per file. Any file
+// the fast path can't handle is copied the regular way.
+static const uint64_t SMALL_FILE_MAX = 16 * 1024;
+static const size_t SMALL_BATCH_FILES = 256;
+static const uint64_t SMALL_BATCH_BYTES = 4ULL << 20;
+
+static bool small_copy_eligible(uint64_t size) {
+    return size < SMALL_FILE_MAX &&
+           !(g_delta_enabled && size >= g_delta_min_bytes) &&
+           !(g_cdc_enabled && size >= g_cdc_min_bytes);
+}
+
+struct SmallCopyBatch {
+    fs::path src_dir, dst_dir;
+    std::vector<std::string> names; // the same file name on both sides
+    uint64_t bytes = 0;
+};
+
+#ifndef _WIN32
+// Copies dir-relative `name` from sfd to dfd through `buf` via a temp name.
+// False leaves nothing behind, so the caller can retry the regular way. With
+// the fingerprint cache on, the data in `buf` also gives both files their
+// fingerprint (complete at this size), as CopyFingerprints does for the rest.
+static bool copy_small_at(int sfd, int dfd, const std::string& name, std::vector<uint8_t>& buf, bool sync_data, uint64_t& copied) {
+    int in = open_source_at(sfd, name.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (in < 0) return false;
+    struct stat st;
+    size_t n = 0;
+    bool ok = ::fstat(in, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size < buf.size();
+    if (ok) g_throttle.acquire((uint64_t)st.st_size);
+    while (ok) {
+        ssize_t r = ::read(in, buf.data() + n, buf.size() - n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) { ok = r == 0; break; }
+        n += (size_t)r;
+        if (n == buf.size()) ok = false; // grew past the buffer since the scan
     }
-    return settings;
+    FileStamp before, after;
+    struct stat now;
+    bool unchanged = ok && ::fstat(in, &now) == 0;
+    if (unchanged) {
+        stamp_from_stat(st, before);
+        stamp_from_stat(now, after);
+        unchanged = after.size == before.size && after.mtime_ns == before.mtime_ns && after.ctime_ns == before.ctime_ns;
+    }
+    drop_read_cache(in, 0, 0);
+    ::close(in);
+    if (!ok) return false;
+    std::string tmp = INTERNAL_FILE_PREFIX + "tmp-" + name;
+    int out = ::openat(dfd, tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (out < 0) return false;
+    ok = pwrite_all(out, buf.data(), n, 0) && ::fchmod(out, st.st_mode & 07777) == 0 && (!sync_data || ::fdatasync(out) == 0);
+#ifdef SYNC_FILE_RANGE_WRITE
+    // small outputs only get their writeback started early; waiting per file would cost too much
+    if (ok && g_no_cache_pollution && !sync_data) ::sync_file_range(out, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+    if (::close(out) != 0) ok = false;
+    if (ok) ok = ::renameat(dfd, tmp.c_str(), dfd, name.c_str()) == 0;
+    if (!ok) ::unlinkat(dfd, tmp.c_str(), 0);
+    copied = n;
+    struct stat dst_st;
+    if (ok && unchanged && n > 0 && g_fp_cache.enabled() && ::fstatat(dfd, name.c_str(), &dst_st, AT_SYMLINK_NOFOLLOW) == 0) {
+        SampledFingerprint fp = compute_buffer_sampled(buf.data(), n);
+        FileStamp out_stamp;
+        stamp_from_stat(dst_st, out_stamp);
+        g_fp_cache.store(after, fp.digest, fp.complete);
+        g_fp_cache.store(out_stamp, fp.digest, fp.complete);
+    }
+    return ok;
 }
+#endif
 
-static uint64_t parse_size_arg(const std::string& s, uint64_t default_val = 0) {
-    if (s.empty()) return default_val;
-    try {
-        size_t idx = 0;
-        uint64_t v = std::stoull(s, &idx);
-        if (idx < s.size()) {
-            char suf = (char)std::toupper(s[idx]);
-            if (suf == 'K') v *= 1024ULL;
-            else if (suf == 'M') v *= 1024ULL * 1024ULL;
-            else if (suf == 'G') v *= 1024ULL * 1024ULL * 1024ULL;
+static void copy_small_batch(const SmallCopyBatch& b, bool verbose, bool enableColors) {
+    std::string log;
+    auto copied_line = [&](const std::string& name) {
+        if (!log.empty()) log += '\n';
+        log += "Copied " + (b.src_dir / name).string() + " -> " + (b.dst_dir / name).string();
+    };
+#ifndef _WIN32
+    int sfd = ::open(b.src_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int dfd = ::open(b.dst_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    std::vector<uint8_t>& buf = hash_read_buffer();
+    const bool sync_data = durability_per_file();
+    bool any_fast = false;
+#endif
+    for (const std::string& name : b.names) {
+#ifndef _WIN32
+        uint64_t n = 0;
+        const auto started = std::chrono::steady_clock::now();
+        if (sfd >= 0 && dfd >= 0 && copy_small_at(sfd, dfd, name, buf, sync_data, n)) {
+            g_copy_meter.record(n, started);
+            g_backend_files[(int)CopyBackend::ReadWrite]++;
+            g_backend_bytes[(int)CopyBackend::ReadWrite] += n;
+            copied_line(name);
+            any_fast = true;
+            continue;
+        }
+#endif
+        try {
+            copy_one_file(b.src_dir / name, b.dst_dir / name, verbose, enableColors);
+        } catch (...) {
+            // logged and counted by copy_one_file
         }
-        return v;
-    } catch (...) {
-        return default_val;
     }
+#ifndef _WIN32
+    if (any_fast) {
+        if (g_durability == Durability::File) ::fsync(dfd);
+        note_dirty_dir(b.dst_dir);
+    }
+    if (sfd >= 0) ::close(sfd);
+    if (dfd >= 0) ::close(dfd);
+#endif
+    if (!log.empty()) logMsg(log, true, enableColors);
 }
 
-// ========== Copy helper ==========
+// Collects small files per directory during the scan and hands full batches
+// (or the current one when the scan moves to another directory) to the pool.
+class SmallFileBatcher {
+public:
+    SmallFileBatcher(bool verbose, bool colors) : verbose(verbose), colors(colors) {}
 
-std::future<void> copyFileAsync(const fs::path& src, const fs::path& dst, bool dryRun, bool verbose, bool enableColors) {
-    if (dryRun) {
-        if (fs::exists(dst)) {
-            logMsg("[DRY-RUN] Would DELETE and then COPY " + src.string() + " -> " + dst.string(), true, enableColors);
-        } else {
-            logMsg("[DRY-RUN] Would copy " + src.string() + " -> " + dst.string(), true, enableColors);
+    void add(const fs::path& src, const fs::path& dst, uint64_t size) {
+        fs::path sdir = src.parent_path();
+        if (!cur.names.empty() && cur.src_dir != sdir) flush();
+        if (cur.names.empty()) {
+            cur.src_dir = sdir;
+            cur.dst_dir = dst.parent_path();
         }
-        return std::async(std::launch::deferred, [](){});
+        cur.names.push_back(dst.filename().string());
+        cur.bytes += size;
+        if (cur.names.size() >= SMALL_BATCH_FILES || cur.bytes >= SMALL_BATCH_BYTES) flush();
     }
 
-    if (!fs::exists(dst.parent_path())) {
-        fs::create_directories(dst.parent_path());
+    void flush() {
+        if (cur.names.empty()) return;
+        if (!fs::exists(cur.dst_dir)) fs::create_directories(cur.dst_dir);
+        auto batch = std::make_shared<SmallCopyBatch>(std::move(cur));
+        cur = SmallCopyBatch();
+        bool v = verbose, c = colors;
+        g_copy_pool.submit([batch, v, c]() { copy_small_batch(*batch, v, c); },
+                           device_of_dir(batch->src_dir), device_of_dir(batch->dst_dir));
     }
 
-    // Wrap the actual copy in a lambda that acquires/releases the semaphore
-    return std::async(std::launch::async, [=]() {
-        // Acquire permission to run (blocks until a slot available).
-        if (g_copy_sem) g_copy_sem->acquire();
-        try {
-            if (fs::exists(dst)) {
-                fs::remove(dst);
-            }
-            fs::copy_file(src, dst); 
-            logMsg("Copied " + src.string() + " -> " + dst.string(), true, enableColors);
-        } catch (const std::exception& ex) {
-            logMsg(std::string("[X] ERROR copying file: ") + ex.what() + " [" + src.string() + "] [" + dst.string() + "]", true, enableColors);
-            // release semaphore before rethrowing
-            if (g_copy_sem) g_copy_sem->release();
-            throw;
+private:
+    bool verbose, colors;
+    SmallCopyBatch cur;
+};
+
+// ========== Physical read order ==========
+// --physical-order, for sources on rotational disks: instead of dispatching
+// copies in directory order as the scan finds them, the scan collects them
+// and hands them to the pool sorted by device and by where each file's data
+// starts on the disk. The workers then sweep across the platter instead of
+// seeking back and forth. The position is the first extent's physical offset
+// from FIEMAP, else the first block from FIBMAP (root only), else the inode
+// number, which on ext4 and XFS roughly follows the on-disk layout. Copies
+// are sorted and dispatched in batches of PHYSICAL_ORDER_BATCH as the scan
+// fills them, so copying overlaps the rest of the scan; the positions of a
+// batch are looked up in parallel.
+static bool g_physical_order = false; // --physical-order
+static const size_t PHYSICAL_ORDER_BATCH = 4096;
+
+enum class PhysicalKey { Fiemap, Fibmap, Inode };
+
+struct OrderedCopy {
+    uint64_t dev, pos;
+    fs::path src, dst;
+    uint64_t size;
+    PhysicalKey key;
+};
+
+static PhysicalKey physical_position(const fs::path& p, uint64_t& dev, uint64_t& pos) {
+    dev = pos = 0;
+#ifdef _WIN32
+    FileStamp st;
+    if (file_stamp(p, st)) {
+        dev = st.dev;
+        pos = st.ino;
+    }
+    return PhysicalKey::Inode;
+#else
+    int fd = open_source(p, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return PhysicalKey::Inode;
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+        dev = (uint64_t)st.st_dev;
+        pos = (uint64_t)st.st_ino;
+    }
+    PhysicalKey kind = PhysicalKey::Inode;
+#if defined(__linux__) && defined(FS_IOC_FIEMAP)
+    alignas(struct fiemap) uint8_t buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    struct fiemap* fm = reinterpret_cast<struct fiemap*>(buf);
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    if (::ioctl(fd, FS_IOC_FIEMAP, fm) == 0 && fm->fm_mapped_extents > 0 &&
+        !(fm->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED))) {
+        pos = fm->fm_extents[0].fe_physical;
+        kind = PhysicalKey::Fiemap;
+    } else {
+        int block = 0;
+        if (::ioctl(fd, FIBMAP, &block) == 0 && block > 0) {
+            pos = (uint64_t)block * (uint64_t)st.st_blksize;
+            kind = PhysicalKey::Fibmap;
         }
-        // normal release
-        if (g_copy_sem) g_copy_sem->release();
-    });
+    }
+#endif
+    ::close(fd);
+    return kind;
+#endif
 }
 
+// ========== Hardlinks ==========
+// A source file with several names (st_nlink > 1: package caches, rsnapshot
+// style backups) is copied once, under the first name the scan meets. Every
+// further name of the same (device, inode) is recreated at the destination as
+// a hardlink to that copy, once the copies are done. Names already linked to
+// it are left alone. A link that can't be made (the first copy failed, or the
+// destination has no hardlinks) falls back to a normal copy.
+// --no-hardlinks copies every name separately.
+static bool g_preserve_hardlinks = true; // --no-hardlinks
+
+class HardlinkTracker {
+public:
+    // For a further name of a file already seen, returns true and the target
+    // its first name was synced to. The first name returns false.
+    bool seen(const fs::directory_entry& e, const fs::path& target, fs::path& first_target) {
+        if (!g_preserve_hardlinks) return false;
+        std::error_code ec;
+        if (e.hard_link_count(ec) < 2 || ec) return false;
+        FileStamp st;
+        if (!file_stamp(e.path(), st)) return false;
+        auto ins = first.emplace(std::make_pair(st.dev, st.ino), target);
+        if (ins.second) return false;
+        first_target = ins.first->second;
+        return true;
+    }
+
+    void defer(const fs::path& src, const fs::path& target, const fs::path& first_target) {
+        pending.push_back({ src, target, first_target });
+    }
+
+    // Creates the deferred links; call after the copies have finished.
+    void apply(bool dryRun, bool verbose, bool enableColors) {
+        size_t created = 0, kept = 0, copied = 0;
+        uint64_t saved = 0;
+        for (const Link& l : pending) {
+            std::error_code ec;
+            uint64_t size = fs::file_size(l.src, ec);
+            if (ec) size = 0;
+            if (dryRun) {
+                logMsg("[DRY-RUN] Would LINK " + l.target.string() + " -> " + l.first_target.string(), true, enableColors);
+                continue;
+            }
+            FileStamp a, b;
+            if (file_stamp(l.target, a) && file_stamp(l.first_target, b) && a.dev == b.dev && a.ino == b.ino) {
+                ++kept;
+                saved += size;
+                continue;
+            }
+            fs::path tmp = temp_path_for(l.target);
+            fs::remove(tmp, ec);
+            fs::create_hard_link(l.first_target, tmp, ec);
+            if (!ec && !install_temp_file(tmp, l.target, ec)) {
+                std::error_code ec2;
+                fs::remove(tmp, ec2);
+            }
+            if (!ec) {
+                ++created;
+                saved += size;
+                logMsg("Linked " + l.target.string() + " -> " + l.first_target.string(), true, enableColors);
+                continue;
+            }
+            logMsg("[!] Could not link " + l.target.string() + " (" + ec.message() + "); copying it instead", verbose, enableColors);
+            ++copied;
+            copyFileAsync(l.src, l.target, false, verbose, enableColors);
+        }
+        if (copied > 0) {
+            g_copy_pool.wait_idle();
+            size_t failed = g_copy_failures.exchange(0);
+            if (failed > 0) logMsg("[X] " + std::to_string(failed) + " of " + std::to_string(copied) + " file copies failed.", true, enableColors);
+        }
+        if (created + kept > 0) {
+            logMsg("[INFO] Hardlinks: " + std::to_string(created + kept) + " extra name(s) linked (" + std::to_string(created) +
+                   " new), " + format_bytes(saved) + " not copied again.", true, enableColors);
+        }
+    }
+
+private:
+    struct Link {
+        fs::path src, target, first_target;
+    };
+    std::map<std::pair<uint64_t, uint64_t>, fs::path> first;
+    std::vector<Link> pending;
+};
 
 // ========== Normalization utilities ==========
 static std::string normalize_generic(const fs::path& p) {
@@ -409,35 +5069,56 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
         logMsg("Source does not exist: " + src.string(), true, enableColors);
         return;
     }
-    if (!dryRun) fs::create_directories(dst);
+    if (!dryRun) { fs::create_directories(dst); note_dirty_dir(dst); remove_stale_temp_files(dst, verbose, enableColors); }
     else if (!fs::exists(dst)) logMsg("[DRY-RUN] Would create directory " + dst.string(), true, enableColors);
 
-    std::unordered_multimap<std::string, fs::path> dst_fp_map;
-    if (g_use_sha256) {
+    std::unordered_multimap<Digest, fs::path> dst_fp_map;
+    if (g_use_content_hash) {
         logMsg("[INFO] Building destination fingerprint index (this may take some time)...", verbose, enableColors);
+        std::vector<fs::path> dst_files;
         for (const auto& e : fs::recursive_directory_iterator(dst)) {
-            if (!e.is_regular_file()) continue;
+            if (!e.is_regular_file() || is_internal_file(e.path())) continue;
             if (dst_entry_src_is_ignored(ignorePaths, dst, e.path(), src)) continue;
-            std::string f = file_fingerprint_hex(e.path());
-            if (!f.empty()) dst_fp_map.emplace(f, e.path());
+            dst_files.push_back(e.path());
         }
+        std::vector<Digest> fps = file_fingerprints(dst_files);
+        dst_fp_map.reserve(dst_files.size());
+        for (size_t i = 0; i < dst_files.size(); ++i) {
+            if (!fps[i].empty()) dst_fp_map.emplace(fps[i], dst_files[i]);
+        }
+        g_fp_cache.prune_unseen_on_save();
         logMsg("[INFO] Destination fingerprint index ready (" + std::to_string(dst_fp_map.size()) + " entries).", verbose, enableColors);
     }
 
-    std::unordered_map<std::string, std::unordered_set<std::string>> dir_fp_cache;
-    auto collect_dir_fps = [&](const fs::path& dir)->std::unordered_set<std::string> {
+#ifndef _WIN32
+    if (g_cdc_enabled && !dryRun) {
+        std::vector<fs::path> chunk_files;
+        std::error_code ec;
+        for (const auto& e : fs::recursive_directory_iterator(dst, ec)) {
+            if (!e.is_regular_file() || is_internal_file(e.path())) continue;
+            std::error_code sec;
+            if (e.file_size(sec) >= g_cdc_min_bytes && !sec) chunk_files.push_back(e.path());
+        }
+        g_chunk_index.set_candidates(std::move(chunk_files));
+    }
+#endif
+
+    std::unordered_map<std::string, std::unordered_set<Digest>> dir_fp_cache;
+    auto collect_dir_fps = [&](const fs::path& dir)->const std::unordered_set<Digest>& {
         std::string key = normalize_generic(dir);
         auto itc = dir_fp_cache.find(key);
         if (itc != dir_fp_cache.end()) return itc->second;
-        std::unordered_set<std::string> s;
-        if (!fs::exists(dir)) { dir_fp_cache.emplace(key, s); return s; }
+        std::unordered_set<Digest>& s = dir_fp_cache[key];
+        if (!fs::exists(dir)) return s;
+        std::vector<fs::path> files;
         for (const auto& f : fs::recursive_directory_iterator(dir)) {
-            if (!f.is_regular_file()) continue;
+            if (!f.is_regular_file() || is_internal_file(f.path())) continue;
             if (matchIgnore(ignorePaths, f.path())) continue;
-            std::string fp = file_fingerprint_hex(f.path());
+            files.push_back(f.path());
+        }
+        for (const Digest& fp : file_fingerprints(files)) {
             if (!fp.empty()) s.insert(fp);
         }
-        dir_fp_cache.emplace(key, s);
         return s;
     };
 
@@ -445,7 +5126,45 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
     std::unordered_set<std::string> reserved_paths; 
 
     std::vector<fs::path> moved_src_roots;
-    std::vector<std::future<void>> copyTasks;
+    size_t queued_copies = 0;
+    SmallFileBatcher small_files(verbose, enableColors);
+    HardlinkTracker hardlinks;
+    std::vector<OrderedCopy> ordered_copies;
+    size_t physical_keys[3] = { 0, 0, 0 };
+    size_t physical_batches = 0;
+    auto dispatch_ordered = [&]() {
+        if (ordered_copies.empty()) return;
+        parallel_for_index(ordered_copies.size(), g_max_concurrent_copies, [&](size_t i) {
+            OrderedCopy& c = ordered_copies[i];
+            c.key = physical_position(c.src, c.dev, c.pos);
+        });
+        std::sort(ordered_copies.begin(), ordered_copies.end(), [](const OrderedCopy& a, const OrderedCopy& b) {
+            return a.dev != b.dev ? a.dev < b.dev : a.pos < b.pos;
+        });
+        // the batcher cuts a batch at every change of directory, so small
+        // files are grouped per directory, placed where the first of them lies
+        auto is_small = [](const OrderedCopy& c) { return c.size != UINT64_MAX && small_copy_eligible(c.size); };
+        std::vector<std::vector<const OrderedCopy*>> units;
+        std::unordered_map<std::string, size_t> dir_unit;
+        for (const OrderedCopy& c : ordered_copies) {
+            physical_keys[(int)c.key]++;
+            if (!is_small(c)) {
+                units.push_back({ &c });
+                continue;
+            }
+            auto ins = dir_unit.emplace(c.src.parent_path().native(), units.size());
+            if (ins.second) units.emplace_back();
+            units[ins.first->second].push_back(&c);
+        }
+        for (const auto& unit : units) {
+            for (const OrderedCopy* c : unit) {
+                if (is_small(*c)) small_files.add(c->src, c->dst, c->size);
+                else copyFileAsync(c->src, c->dst, dryRun, verbose, enableColors);
+            }
+        }
+        ordered_copies.clear();
+        physical_batches++;
+    };
     int operations_count = 0;
 
     for (auto it = fs::recursive_directory_iterator(src); it != fs::recursive_directory_iterator(); ++it) {
@@ -467,12 +5186,20 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
             if (entry.is_directory()) it.disable_recursion_pending();
             continue;
         }
+        if (is_internal_file(entry.path())) {
+            // the name is reserved for the tool's files at the destination,
+            // where it would be hidden from mirror mode or taken for a temp file
+            logMsg("[!] WARNING: Skipped " + entry.path().string() + ": names starting with " + INTERNAL_FILE_PREFIX +
+                   " are reserved.", true, enableColors);
+            if (entry.is_directory()) it.disable_recursion_pending();
+            continue;
+        }
 
         if (entry.is_directory()) {
             if (!fs::exists(target)) {
                 bool didDirMove = false;
-                if (g_use_sha256) {
-                    auto src_fps = collect_dir_fps(entry.path());
+                if (g_use_content_hash) {
+                    const auto& src_fps = collect_dir_fps(entry.path());
                     if (!src_fps.empty()) {
                         fs::path dst_parent = dst / rel.parent_path();
                         if (fs::exists(dst_parent) && fs::is_directory(dst_parent)) {
@@ -482,7 +5209,7 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                                 std::string cand_norm = normalize_generic(cand_path);
                                 if (reserved_dirs.find(cand_norm) != reserved_dirs.end()) continue;
                                 if (dst_entry_src_is_ignored(ignorePaths, dst, cand_path, src)) continue;
-                                auto cand_fps = collect_dir_fps(cand_path);
+                                const auto& cand_fps = collect_dir_fps(cand_path);
                                 if (cand_fps.empty()) continue;
                                 size_t common = 0;
                                 for (const auto& fp : src_fps) if (cand_fps.find(fp) != cand_fps.end()) ++common;
@@ -510,7 +5237,7 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                                                     fs::path rel2 = fs::relative(e2.path(), cand_path);
                                                     fs::path dest2 = target / rel2;
                                                     if (!fs::exists(dest2.parent_path())) fs::create_directories(dest2.parent_path());
-                                                    fs::copy_file(e2.path(), dest2, fs::copy_options::overwrite_existing);
+                                                    copy_file_data(e2.path(), dest2);
                                                 }
                                                 fs::remove_all(cand_path);
                                                 logMsg(std::string("[INFO] Copied directory ") + cand_path.string() + " -> " + target.string() + " (cross-volume move)", true, enableColors);
@@ -549,16 +5276,26 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                     logMsg("Create Directory " + target.string(), true, enableColors);
                     reserved_paths.insert(normalize_generic(target));
                 }
-            } else {
+            } else if (!dryRun) {
+                remove_stale_temp_files(target, verbose, enableColors);
             }
             continue;
         }
 
+        fs::path first_target;
+        if (hardlinks.seen(entry, target, first_target)) {
+            reserved_paths.insert(normalize_generic(target));
+            hardlinks.defer(entry.path(), target, first_target);
+            if (dryRun) operations_count++;
+            continue;
+        }
+
         bool needCopy = false;
         if (!fs::exists(target)) {
             bool moved = false;
-            if (g_use_sha256 && !dst_fp_map.empty()) {
-                std::string sfp = file_fingerprint_hex(entry.path());
+            if (g_use_content_hash && !dst_fp_map.empty()) {
+                SampledFingerprint sampled = file_sampled_fingerprint(entry.path());
+                const Digest& sfp = sampled.digest;
                 if (!sfp.empty()) {
                     auto range = dst_fp_map.equal_range(sfp);
                     for (auto dit = range.first; dit != range.second; ++dit) {
@@ -567,6 +5304,8 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                         std::string cand_norm = normalize_generic(candidate);
                         if (reserved_paths.find(cand_norm) != reserved_paths.end()) continue;
                         if (!fs::exists(candidate)) continue;
+                        if (!confirm_sampled_match(entry.path(), candidate, sampled.complete)) continue;
+                        if (verbose) logMsg("[INFO] Fingerprint match " + fingerprint_to_string(sfp) + ": " + candidate.string(), true, enableColors);
                         if (dryRun) {
                             logMsg("[DRY-RUN] Would MOVE (rename) " + candidate.string() + " -> " + target.string(), true, enableColors);
                             reserved_paths.insert(normalize_generic(candidate));
@@ -580,7 +5319,7 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                                 if (!ec) {
                                     logMsg(std::string("[INFO] Renamed file ") + candidate.string() + " -> " + target.string(), true, enableColors);
                                 } else {
-                                    fs::copy_file(candidate, target, fs::copy_options::overwrite_existing);
+                                    copy_file_data(candidate, target);
                                     fs::remove(candidate);
                                     logMsg(std::string("[INFO] Copied file ") + candidate.string() + " -> " + target.string() + " (cross-volume move)", true, enableColors);
                                     logMsg(std::string("[INFO] Deleted original ") + candidate.string(), true, enableColors);
@@ -601,7 +5340,7 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
             }
             if (!moved) needCopy = true;
         } else {
-            if (g_use_sha256) {
+            if (g_use_content_hash) {
                 std::error_code ec1, ec2;
                 uintmax_t ssz = fs::file_size(entry.path(), ec1);
                 uintmax_t tsz = fs::file_size(target, ec2);
@@ -615,9 +5354,7 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                 } else if (ssz != tsz) {
                     needCopy = true;
                 } else {
-                    std::string sh = file_fingerprint_hex(entry.path());
-                    std::string dh = file_fingerprint_hex(target);
-                    if (sh.empty() || dh.empty() || sh != dh) needCopy = true;
+                    if (!files_have_same_content(entry.path(), target)) needCopy = true;
                 }
             } else {
                 if (fs::last_write_time(entry.path()) > fs::last_write_time(target)) needCopy = true;
@@ -632,16 +5369,48 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
                 reserved_paths.insert(normalize_generic(target));
             } else {
                 reserved_paths.insert(normalize_generic(target));
-                copyTasks.push_back(copyFileAsync(entry.path(), target, dryRun, verbose, enableColors));
+                std::error_code sec;
+                uint64_t sz = entry.file_size(sec);
+                if (g_physical_order) {
+                    ordered_copies.push_back(OrderedCopy{ 0, 0, entry.path(), target, sec ? UINT64_MAX : sz, PhysicalKey::Inode });
+                    if (ordered_copies.size() >= PHYSICAL_ORDER_BATCH) dispatch_ordered();
+                }
+                else if (!sec && small_copy_eligible(sz)) small_files.add(entry.path(), target, sz);
+                else copyFileAsync(entry.path(), target, dryRun, verbose, enableColors);
+                queued_copies++;
             }
         }
     }
 
+    dispatch_ordered();
+    if (physical_batches > 0) {
+        logMsg("[INFO] Physical order: " + std::to_string(physical_keys[0] + physical_keys[1] + physical_keys[2]) +
+               " copies sorted in " + std::to_string(physical_batches) + " batch(es) (" +
+               std::to_string(physical_keys[0]) + " by FIEMAP, " + std::to_string(physical_keys[1]) + " by FIBMAP, " +
+               std::to_string(physical_keys[2]) + " by inode).", verbose, enableColors);
+    }
+    small_files.flush();
+
     if (mirror) {
         logMsg("\nMirror mode enabled. Checking for files to delete from destination...", verbose, enableColors);
         std::vector<fs::path> pathsToDelete;
         for (const auto& entry : fs::recursive_directory_iterator(dst)) {
             if (is_reserved_path_norm(reserved_dirs, reserved_paths, entry.path())) continue;
+            if (is_internal_file(entry.path())) {
+                // a resumable copy whose source is gone: drop the journal and its partial file
+                const std::string journal_prefix = INTERNAL_FILE_PREFIX + "resume-";
+                std::string name = entry.path().filename().string();
+                if (name.rfind(journal_prefix, 0) != 0) continue;
+                name = name.substr(journal_prefix.size());
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".new") == 0) name.resize(name.size() - 4);
+                fs::path target = entry.path().parent_path() / name;
+                fs::path srcPath = src / fs::relative(target, dst);
+                if (!fs::exists(srcPath) && !matchIgnore(ignorePaths, srcPath)) {
+                    pathsToDelete.push_back(entry.path());
+                    if (fs::exists(temp_path_for(target))) pathsToDelete.push_back(temp_path_for(target));
+                }
+                continue;
+            }
             if (dst_entry_src_is_ignored(ignorePaths, dst, entry.path(), src)) continue;
             fs::path srcPath = src / fs::relative(entry.path(), dst);
             if (!fs::exists(srcPath) && !matchIgnore(ignorePaths, srcPath)) {
@@ -658,10 +5427,13 @@ void syncDir(const fs::path& src, const fs::path& dst, const std::vector<fs::pat
         }
     }
 
-    if (!dryRun && !copyTasks.empty()) {
+    if (!dryRun && queued_copies > 0) {
         logMsg("Waiting for all copy tasks to complete...", true, enableColors);
-        for (auto& t : copyTasks) { try { t.get(); } catch (const std::exception& ex) { logMsg(std::string("[X] COPY TASK ERROR: ") + ex.what(), true, enableColors); } catch (...) { logMsg("[X] COPY TASK ERROR (unknown)", true, enableColors); } }
+        g_copy_pool.wait_idle();
+        size_t failed = g_copy_failures.exchange(0);
+        if (failed > 0) logMsg("[X] " + std::to_string(failed) + " of " + std::to_string(queued_copies) + " file copies failed.", true, enableColors);
     }
+    hardlinks.apply(dryRun, verbose, enableColors);
 
     logMsg("\nAll Tasks Finished !!", verbose || dryRun, enableColors);
     if (dryRun && operations_count == 0) {
@@ -679,16 +5451,14 @@ void syncFile(const fs::path& src, const fs::path& dst, bool dryRun, bool verbos
     bool needCopy = false;
     if (!fs::exists(target)) needCopy = true;
     else {
-        if (g_use_sha256) {
+        if (g_use_content_hash) {
             std::error_code ec1, ec2;
             uintmax_t ssz = fs::file_size(src, ec1);
             uintmax_t tsz = fs::file_size(target, ec2);
             if (ec1 || ec2) { if (fs::last_write_time(src) > fs::last_write_time(target)) needCopy = true; }
             else if (ssz != tsz) needCopy = true;
             else {
-                std::string sh = file_fingerprint_hex(src);
-                std::string dh = file_fingerprint_hex(target);
-                if (sh.empty() || dh.empty() || sh != dh) needCopy = true;
+                if (!files_have_same_content(src, target)) needCopy = true;
             }
         } else {
         std::error_code ec1, ec2;
@@ -701,7 +5471,10 @@ void syncFile(const fs::path& src, const fs::path& dst, bool dryRun, bool verbos
     }
     if (needCopy) {
         if (dryRun) logMsg("[DRY-RUN] Would copy " + src.string() + " -> " + target.string(), true, enableColors);
-        else { auto fut = copyFileAsync(src, target, dryRun, verbose, enableColors); fut.get(); }
+        else {
+            copyFileAsync(src, target, dryRun, verbose, enableColors);
+            if (g_copy_pool.wait_idle() > 0) logMsg("[X] COPY TASK ERROR: " + target.string(), true, enableColors);
+        }
     }
 }
 
@@ -804,11 +5577,33 @@ void printHelp(const std::string& exeName) {
               << "  --color             Colored output\n"
               << "  --save-log          Save operations to sync.log\n"
               << "  --save-settings     Save arguments to settings.json\n"
-              << "  --sha256            Use SHA-256 (Windows CNG) for fingerprints\n"
-              << "  --sha256-min <N>    Minimum file size to use SHA (e.g. 1M, 500K)\n"
-              << "  --sha256-max <N>    Maximum file size to use SHA (e.g. 500M, 2G)\n"
+              << "  --sha256            Use SHA-256 (built-in, SHA-NI/AVX2 accelerated) for fingerprints\n"
+              << "  --hash=<algo>       Content-aware mode: sampled, sha256, xxh3 (XXH3-128) or blake3\n"
+              << "  --sha256-min <N>    Minimum file size for the full-content hash (e.g. 1M, 500K)\n"
+              << "  --sha256-max <N>    Maximum file size for the full-content hash (e.g. 500M, 2G)\n"
+              << "  --no-fp-cache       Don't read or update the fingerprint cache kept in the destination\n"
+              << "  --no-io-uring       [Linux] Read fingerprint samples with pread instead of io_uring\n"
+              << "  --delta             Update changed large files with rsync-style deltas instead of full copies\n"
+              << "  --delta-min <N>     Smallest file that gets a delta update (default 64M; implies --delta)\n"
+              << "  --delta-inplace     Patch in place when no data moved (fewer writes, not crash-safe)\n"
+              << "  --cdc               Build new large files from chunks the destination already has (reflink filesystems)\n"
+              << "  --cdc-min <N>       Smallest file indexed and assembled from chunks (default 16M; implies --cdc)\n"
+              << "  --durability=<mode> When written files reach the disk: none (default), end (one syncfs per\n"
+              << "                      destination filesystem at the end) or file (fdatasync before every rename)\n"
+              << "  --parallel-copy-min <N> Copy files of at least N bytes as parallel ranges (default 1G)\n"
+              << "  --no-cache-pollution Drop synced data from the page cache as it streams; open sources O_NOATIME\n"
+              << "  --bwlimit=<rate>    Cap copy and hash I/O at <rate> bytes/s, e.g. 50M (0 = off)\n"
+              << "  --iops-limit=<N>    Cap copy and hash I/O at N operations per second\n"
+              << "  --resume-min <N>    [POSIX] Copy files of at least N bytes resumably, with a journal (default 1G)\n"
+              << "  --no-resume         [POSIX] Don't keep or resume partial copies of large files\n"
+              << "  --no-preallocate    [Linux] Don't reserve destination space with fallocate before copying\n"
+              << "  --physical-order    Copy in on-disk order of the source data (for HDD sources)\n"
+              << "  --no-hardlinks      Copy every name of a hardlinked file separately\n"
+              << "  --fixed-concurrency Keep the copy concurrency of the speed mode instead of adapting it\n"
               << "  --ultra-speed       Boost priority and concurrency for faster syncs\n"
               << "  --minimum-speed     Lower priority and concurrency to save resources\n"
+              << "  --bench-hash [N]    Measure hash kernel throughput on an N-byte buffer (default 256M)\n"
+              << "  --bench-read <file> Compare ifstream, pread and mmap hashing throughput (cold and hot cache)\n"
 #ifdef _WIN32
               << "  --add-to-path       [Windows] add tool to user PATH\n"
 #endif
@@ -843,8 +5638,25 @@ static void apply_speed_policy_and_init_concurrency(bool verbose, bool enableCol
         logMsg(std::string("[INFO] Normal speed: concurrency=") + std::to_string(g_max_concurrent_copies), true, enableColors);
     }
 
-    // init semaphore with concurrency count
-    g_copy_sem = std::make_shared<SimpleSemaphore>(g_max_concurrent_copies);
+    // --minimum-speed also caps bandwidth unless --bwlimit says otherwise
+    if (g_minimum_speed && !g_bwlimit_set) g_bwlimit = MINIMUM_SPEED_BWLIMIT;
+    g_throttle.configure(g_bwlimit, g_iops_limit);
+    if (g_throttle.active()) {
+        logMsg("[INFO] I/O limit: " + (g_bwlimit ? format_bytes(g_bwlimit) + "/s" : std::string("no byte limit")) +
+               (g_iops_limit ? ", " + std::to_string(g_iops_limit) + " IOPS" : std::string()), true, enableColors);
+    }
+
+    // start the copy workers; each device pair's queue holds a bounded backlog
+    // per worker. Unless the budget is pinned, the controller moves the
+    // per-device budget between 1 and the ceiling as the copies run.
+    if (g_minimum_speed || g_fixed_concurrency) {
+        g_copy_pool.start(g_max_concurrent_copies, (size_t)g_max_concurrent_copies * 64);
+        return;
+    }
+    int ceiling = g_ultra_speed ? std::max(16u, hc * 8) : std::max(8u, hc * 4);
+    g_copy_pool.start(g_max_concurrent_copies, (size_t)ceiling * 64);
+    g_concurrency.start(g_max_concurrent_copies, 1, ceiling, verbose, enableColors);
+    if (verbose) logMsg("[INFO] Adaptive concurrency: 1-" + std::to_string(ceiling) + " copy workers", true, enableColors);
 }
 
 // ========== Main ==========
@@ -860,7 +5672,8 @@ int main(int argc, char* argv[]) {
     }
 
     bool dryRun=false, verbose=false, saveSettingsFlag=false, mirror=false;
-    bool saveLog=false, enableColors=false, useSha256=false;
+    bool saveLog=false, enableColors=false, useContentHash=false;
+    HashAlgo hashAlgo = HashAlgo::Sampled;
     std::vector<fs::path> ignorePaths;
     std::map<std::string,std::string> settings;
     std::string mode; fs::path src, dst;
@@ -876,7 +5689,15 @@ int main(int argc, char* argv[]) {
         else if (arg=="--save-settings") saveSettingsFlag=true;
         else if (arg=="--save-log") saveLog=true;
         else if (arg=="--color") enableColors=true;
-        else if (arg=="--sha256") useSha256=true;
+        else if (arg=="--sha256") { useContentHash=true; hashAlgo=HashAlgo::Sha256; }
+        else if (arg.rfind("--hash=", 0)==0 || (arg=="--hash" && i+1<argc)) {
+            std::string name = (arg=="--hash") ? std::string(argv[++i]) : arg.substr(7);
+            if (!parse_hash_algo(name, hashAlgo)) {
+                logMsg("[X] ERROR: Unknown hash algorithm '" + name + "' (use sampled, sha256, xxh3 or blake3).", true, enableColors);
+                return 1;
+            }
+            useContentHash=true;
+        }
         else if (arg=="--sha256-min" && i+1<argc) {
             g_sha256_min_bytes = parse_size_arg(argv[++i], g_sha256_min_bytes);
             g_sha256_min_set = true;
@@ -885,8 +5706,46 @@ int main(int argc, char* argv[]) {
             g_sha256_max_bytes = parse_size_arg(argv[++i], g_sha256_max_bytes);
             g_sha256_max_set = true;
         }
+        else if (arg=="--no-fp-cache") g_fp_cache_enabled = false;
+        else if (arg=="--no-io-uring") g_io_uring_enabled = false;
+        else if (arg=="--delta") g_delta_enabled = true;
+        else if (arg=="--delta-inplace") { g_delta_enabled = true; g_delta_inplace = true; }
+        else if (arg=="--cdc") g_cdc_enabled = true;
+        else if (arg=="--cdc-min" && i+1<argc) { g_cdc_enabled = true; g_cdc_min_bytes = parse_size_arg(argv[++i], g_cdc_min_bytes); }
+        else if (arg=="--delta-min" && i+1<argc) { g_delta_enabled = true; g_delta_min_bytes = parse_size_arg(argv[++i], g_delta_min_bytes); }
+        else if (arg.rfind("--durability=", 0)==0 || (arg=="--durability" && i+1<argc)) {
+            std::string name = (arg=="--durability") ? std::string(argv[++i]) : arg.substr(13);
+            if (!parse_durability(name, g_durability)) {
+                logMsg("[X] ERROR: Unknown durability mode '" + name + "' (use none, end or file).", true, enableColors);
+                return 1;
+            }
+        }
+        else if (arg=="--parallel-copy-min" && i+1<argc) g_parallel_copy_min = parse_size_arg(argv[++i], g_parallel_copy_min);
+        else if (arg=="--no-cache-pollution") g_no_cache_pollution = true;
+        else if (arg=="--fixed-concurrency") g_fixed_concurrency = true;
+        else if (arg=="--no-preallocate") g_preallocate = false;
+        else if (arg=="--no-hardlinks") g_preserve_hardlinks = false;
+        else if (arg=="--physical-order") g_physical_order = true;
+        else if (arg=="--no-resume") g_resume_enabled = false;
+        else if (arg=="--resume-min" && i+1<argc) g_resume_min = parse_size_arg(argv[++i], g_resume_min);
+        else if (arg.rfind("--bwlimit=", 0)==0 || (arg=="--bwlimit" && i+1<argc)) {
+            std::string v = (arg=="--bwlimit") ? std::string(argv[++i]) : arg.substr(10);
+            g_bwlimit = parse_size_arg(v, 0);
+            g_bwlimit_set = true;
+        }
+        else if (arg.rfind("--iops-limit=", 0)==0 || (arg=="--iops-limit" && i+1<argc)) {
+            std::string v = (arg=="--iops-limit") ? std::string(argv[++i]) : arg.substr(13);
+            g_iops_limit = parse_size_arg(v, 0);
+        }
         else if (arg=="--ultra-speed") g_ultra_speed = true;
         else if (arg=="--minimum-speed") g_minimum_speed = true;
+        else if (arg=="--bench-hash") {
+            uint64_t bytes = 256ULL * 1024ULL * 1024ULL;
+            if (i+1<argc && std::isdigit((unsigned char)argv[i+1][0])) bytes = parse_size_arg(argv[++i], bytes);
+            run_hash_benchmark(bytes);
+            return 0;
+        }
+        else if (arg=="--bench-read" && i+1<argc) { run_read_benchmark(argv[++i]); return 0; }
         else if (arg=="-h" || arg=="--help") { printHelp(fs::path(argv[0]).filename().string()); return 0; }
 #ifdef _WIN32
         else if (arg=="--add-to-path") { addToPath(fs::absolute(fs::path(argv[0])), true, enableColors); return 0; }
@@ -901,7 +5760,10 @@ int main(int argc, char* argv[]) {
             mode = loaded["mode"]; src = loaded["src"]; dst = loaded["dst"];
             if (!mirror) mirror = (loaded["mirror"]=="true");
             if (!verbose) verbose = (loaded["verbose"]=="true");
-            if (!useSha256) useSha256 = (loaded["sha256"]=="true");
+            if (!useContentHash) {
+                if (loaded.count("hash") && parse_hash_algo(loaded["hash"], hashAlgo)) useContentHash = true;
+                else if (loaded["sha256"]=="true") { useContentHash = true; hashAlgo = HashAlgo::Sha256; }
+            }
             if (loaded.count("sha256_min")) {
                 g_sha256_min_bytes = parse_size_arg(loaded["sha256_min"], g_sha256_min_bytes);
                 g_sha256_min_set = true;
@@ -913,14 +5775,79 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    g_use_sha256 = useSha256;
+    g_use_content_hash = useContentHash;
+    g_hash_algo = hashAlgo;
     apply_speed_policy_and_init_concurrency(verbose, enableColors);
+    if (g_use_content_hash) {
+        // recorded in sync.log too, so digests from different runs are never confused
+        std::string desc = std::string("[INFO] Fingerprint algorithm: ") + hash_algo_name(g_hash_algo);
+        if (g_hash_algo != HashAlgo::Sampled) desc += std::string(" (confirms sampled matches") +
+            ((g_sha256_min_set || g_sha256_max_set) ? " inside the size window)" : ")");
+        logMsg(desc, true, enableColors);
+        if (g_fp_cache_enabled && !dst.empty()) g_fp_cache.load(dst / FP_CACHE_NAME);
+#ifdef SYNC_HAVE_IO_URING
+        if (g_io_uring_enabled) g_io_uring_enabled = io_uring_usable();
+        logMsg(g_io_uring_enabled ? "[INFO] Fingerprint reads: io_uring, queue depth " + std::to_string(uring_queue_depth())
+                                  : std::string("[INFO] Fingerprint reads: pread"), verbose, enableColors);
+#else
+        g_io_uring_enabled = false;
+#endif
+    }
     auto start = std::chrono::high_resolution_clock::now();
 
     if (mode=="dir") syncDir(src,dst,ignorePaths,dryRun,verbose,mirror,enableColors);
     else if (mode=="file") syncFile(src,dst,dryRun,verbose,enableColors);
     else { logMsg("[X] ERROR: No valid operation specified. Use --dir or --file.", true, enableColors); printHelp(fs::path(argv[0]).filename().string()); return 1; }
 
+    if (g_fp_cache.enabled()) {
+        logMsg("[INFO] Fingerprint cache: " + std::to_string(g_fp_cache.hits.load()) + " hits, " +
+               std::to_string(g_fp_cache.misses.load()) + " misses.", verbose, enableColors);
+        if (!dryRun && !g_fp_cache.save())
+            logMsg("[!] WARNING: Could not update fingerprint cache " + (dst / FP_CACHE_NAME).string(), true, enableColors);
+    }
+    if (g_durability == Durability::End && !dryRun) {
+        auto t0 = std::chrono::steady_clock::now();
+        size_t n = sync_dirty_filesystems();
+        std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+        if (n > 0) logMsg("[INFO] Flushed " + std::to_string(n) + " destination filesystem(s) to disk in " +
+                          std::to_string(dt.count()) + " s.", verbose, enableColors);
+    }
+    if (g_delta_files > 0) {
+        logMsg("[INFO] Delta updates: " + std::to_string(g_delta_files.load()) + " file(s), " +
+               format_bytes(g_delta_literal_bytes) + " literal data, " + format_bytes(g_delta_reused_bytes) +
+               " reused from the destination (" + format_bytes(g_delta_cloned_bytes) + " of it cloned).", true, enableColors);
+    }
+    std::string backends = copy_backend_summary();
+    if (!backends.empty()) logMsg("[INFO] Copy backends: " + backends + ".", true, enableColors);
+    if (g_copy_hashed_files > 0) {
+        logMsg("[INFO] Hashed while copying: " + std::to_string(g_copy_hashed_files.load()) + " file(s) / " +
+               format_bytes(g_copy_hashed_bytes) + " through read/write instead of the backends above; their fingerprints went to the cache.",
+               true, enableColors);
+    }
+    if (g_copy_unhashed_files > 0) {
+        logMsg("[INFO] Not hashed while copying: " + std::to_string(g_copy_unhashed_files.load()) + " file(s) / " +
+               format_bytes(g_copy_unhashed_bytes) + ", large enough for parallel kernel-side copies; the next run hashes them.",
+               true, enableColors);
+    }
+    if (g_resumed_files > 0) {
+        logMsg("[INFO] Resumed " + std::to_string(g_resumed_files.load()) + " interrupted copy(ies); " +
+               format_bytes(g_resumed_bytes) + " were already at the destination.", true, enableColors);
+    }
+    if (g_prealloc_files > 0) {
+        logMsg("[INFO] Preallocated " + std::to_string(g_prealloc_files.load()) + " file(s) / " +
+               format_bytes(g_prealloc_bytes) + " before writing.", verbose, enableColors);
+    }
+    g_concurrency.stop();
+    std::string concurrency = g_concurrency.summary();
+    if (!concurrency.empty()) logMsg("[INFO] " + concurrency, true, enableColors);
+    std::string queues = g_copy_pool.lane_summary();
+    if (!queues.empty()) logMsg("[INFO] Copy queues: " + queues + ".", true, enableColors);
+    if (g_cdc_files > 0) {
+        logMsg("[INFO] Chunk reuse: " + std::to_string(g_cdc_files.load()) + " file(s), " +
+               format_bytes(g_cdc_matched_bytes) + " found in the destination, " +
+               format_bytes(g_cdc_cloned_bytes) + " cloned instead of written.", true, enableColors);
+    }
+
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> dur = end - start;
     std::cout << "\n========================================\n";
@@ -929,7 +5856,8 @@ int main(int argc, char* argv[]) {
 
     if (saveSettingsFlag && !mode.empty()) {
         settings["mode"]=mode; settings["src"]=src.string(); settings["dst"]=dst.string();
-        settings["mirror"]=mirror?"true":"false"; settings["verbose"]=verbose?"true":"false"; settings["sha256"]=g_use_sha256?"true":"false";
+        settings["mirror"]=mirror?"true":"false"; settings["verbose"]=verbose?"true":"false"; settings["sha256"]=(g_use_content_hash && g_hash_algo==HashAlgo::Sha256)?"true":"false";
+        if (g_use_content_hash) settings["hash"]=hash_algo_name(g_hash_algo);
         if (g_sha256_min_set) settings["sha256_min"]=std::to_string(g_sha256_min_bytes);
         if (g_sha256_max_set) settings["sha256_max"]=std::to_string(g_sha256_max_bytes);    
         saveSettings(settings);